@@ -0,0 +1,163 @@
+// Runs each benchmark workload through the paint binary several times and reports wall time,
+// heap allocations and peak resident memory as JSON on stdout.
+//
+// Usage: paint_bench [--runs N] [--tree-walk] [--parse-jobs N] [workload...]
+
+#include "generate.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef PAINT_BINARY
+#define PAINT_BINARY "paint"
+#endif
+
+#ifndef BENCH_DIR
+#define BENCH_DIR "bench"
+#endif
+
+struct Workload {
+  std::string name;
+  std::filesystem::path path;
+};
+
+struct RunResult {
+  double wall_ms;
+  long peak_rss_kb;
+  size_t allocations;
+  size_t execution_allocations;
+};
+
+// Run paint once on the workload, discarding its output and reading its allocation stats
+RunResult run_once(const Workload& workload, bool tree_walk, const std::string& parse_jobs) {
+  int err_pipe[2];
+  if (pipe(err_pipe) != 0) {
+    std::cerr << "Could not create pipe.\n";
+    std::exit(EXIT_FAILURE);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  pid_t pid = fork();
+
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(err_pipe[1], STDERR_FILENO);
+    close(err_pipe[0]);
+
+    std::vector<const char*> args = { PAINT_BINARY, "--alloc-stats" };
+    if (tree_walk) {
+      args.emplace_back("--tree-walk");
+    }
+    if (!parse_jobs.empty()) {
+      args.emplace_back("--parse-jobs");
+      args.emplace_back(parse_jobs.c_str());
+    }
+    args.emplace_back(workload.path.c_str());
+    args.emplace_back(nullptr);
+
+    execv(PAINT_BINARY, const_cast<char* const*>(args.data()));
+    _exit(127);
+  }
+
+  close(err_pipe[1]);
+  std::string err_output;
+  char buffer[4096];
+  ssize_t count;
+  while ((count = read(err_pipe[0], buffer, sizeof(buffer))) > 0) {
+    err_output.append(buffer, count);
+  }
+  close(err_pipe[0]);
+
+  int status;
+  struct rusage usage;
+  wait4(pid, &status, 0, &usage);
+  auto end = std::chrono::steady_clock::now();
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    std::cerr << "Workload `" << workload.name << "` failed:\n" << err_output;
+    std::exit(EXIT_FAILURE);
+  }
+
+  // Parse "allocations: N (B bytes), E during execution"
+  RunResult result{ std::chrono::duration<double, std::milli>(end - start).count(), usage.ru_maxrss, 0, 0 };
+  size_t pos = err_output.rfind("allocations: ");
+  if (pos != std::string::npos) {
+    std::istringstream stats(err_output.substr(pos + 13));
+    std::string skip;
+    stats >> result.allocations >> skip >> skip >> result.execution_allocations;
+  }
+
+  return result;
+}
+
+int main(int argc, char* argv[]) {
+  int runs = 5;
+  bool tree_walk = false;
+  std::string parse_jobs;
+  std::vector<std::string> filter;
+
+  for (int idx = 1; idx < argc; ++idx) {
+    std::string arg = argv[idx];
+    if (arg == "--runs" && idx + 1 < argc) {
+      runs = std::max(1, std::stoi(argv[++idx]));
+    } else if (arg == "--tree-walk") {
+      tree_walk = true;
+    } else if (arg == "--parse-jobs" && idx + 1 < argc) {
+      parse_jobs = argv[++idx];
+    } else {
+      filter.emplace_back(arg);
+    }
+  }
+
+  std::vector<Workload> workloads;
+  for (const char* name : { "fib", "numeric_loop", "string_concat", "nested_objects", "many_calls" }) {
+    workloads.emplace_back(Workload{ name, std::filesystem::path(BENCH_DIR) / (std::string(name) + ".wp") });
+  }
+  workloads.emplace_back(Workload{ "large_parse", generate_large_file("paint_bench_large.wp", 20000) });
+
+  std::cout << "{\n  \"engine\": \"" << (tree_walk ? "tree-walk" : "vm") << "\",\n"
+            << "  \"runs\": " << runs << ",\n  \"workloads\": [";
+
+  bool first = true;
+  for (const Workload& workload : workloads) {
+    if (!filter.empty() && std::find(filter.begin(), filter.end(), workload.name) == filter.end()) {
+      continue;
+    }
+
+    std::vector<RunResult> results;
+    for (int run = 0; run < runs; ++run) {
+      results.emplace_back(run_once(workload, tree_walk, parse_jobs));
+    }
+
+    double min_ms = results.front().wall_ms;
+    double total_ms = 0;
+    long peak_rss_kb = 0;
+    for (const RunResult& result : results) {
+      min_ms = std::min(min_ms, result.wall_ms);
+      total_ms += result.wall_ms;
+      peak_rss_kb = std::max(peak_rss_kb, result.peak_rss_kb);
+    }
+
+    std::cout << (first ? "\n" : ",\n")
+              << "    { \"name\": \"" << workload.name << "\""
+              << ", \"wall_ms_min\": " << min_ms
+              << ", \"wall_ms_mean\": " << total_ms / runs
+              << ", \"allocations\": " << results.front().allocations
+              << ", \"execution_allocations\": " << results.front().execution_allocations
+              << ", \"peak_rss_kb\": " << peak_rss_kb << " }";
+    first = false;
+  }
+
+  std::cout << "\n  ]\n}\n";
+  return EXIT_SUCCESS;
+}
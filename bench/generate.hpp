@@ -0,0 +1,32 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+// Write a large program made of many small functions, objects, strings and loops to dir, the temp
+// directory by default, for the parse and lexer workloads
+inline std::filesystem::path generate_large_file(const std::string& name, int functions,
+    const std::filesystem::path& dir = std::filesystem::temp_directory_path()) {
+  std::filesystem::path path = dir / name;
+  std::ofstream out(path);
+
+  for (int idx = 0; idx < functions; ++idx) {
+    out << "# Generated function " << idx << "\n"
+        << "fn work_" << idx << "(a, b) {\n"
+        << "  let point = { x = a, y = b, label = \"p" << idx << "\" }\n"
+        << "  let sum = 0\n"
+        << "  for (i = 0, i < 3, i++) {\n"
+        << "    if (i % 2 == 0) {\n"
+        << "      sum = sum + point.x * " << idx % 97 << "\n"
+        << "    } else {\n"
+        << "      sum = sum - point.y / 2.5\n"
+        << "    }\n"
+        << "  }\n"
+        << "  return sum\n"
+        << "}\n";
+  }
+
+  out << "print(work_0(1, 2) + work_" << functions - 1 << "(3, 4))\n";
+  return path;
+}
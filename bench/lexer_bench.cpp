@@ -0,0 +1,56 @@
+// Measures Tokenizer throughput in MB/s on a generated multi-megabyte program and reports
+// it as JSON on stdout.
+//
+// Usage: lexer_bench [--runs N] [--functions N]
+
+#include "generate.hpp"
+#include "../src/source.hpp"
+#include "../src/tokenizer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+int main(int argc, char* argv[]) {
+  int runs = 10;
+  int functions = 50000;
+
+  for (int idx = 1; idx < argc; ++idx) {
+    std::string arg = argv[idx];
+    if (arg == "--runs" && idx + 1 < argc) {
+      runs = std::max(1, std::stoi(argv[++idx]));
+    } else if (arg == "--functions" && idx + 1 < argc) {
+      functions = std::max(1, std::stoi(argv[++idx]));
+    }
+  }
+
+  Source source(generate_large_file("paint_lexer_bench.wp", functions));
+  Error error(source.text());
+  double megabytes = source.text().size() / (1024.0 * 1024.0);
+
+  // The first run interns every name, later runs measure scanning with a warm symbol table
+  size_t token_count = 0;
+  double best_ms = 0;
+  double total_ms = 0;
+  for (int run = 0; run < runs; ++run) {
+    auto start = std::chrono::steady_clock::now();
+    Tokenizer tokenizer(source.text(), error);
+    std::vector<Token> tokens = tokenizer.tokenize();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    token_count = tokens.size();
+    best_ms = run == 0 ? ms : std::min(best_ms, ms);
+    total_ms += ms;
+  }
+
+  std::cout << "{\n"
+            << "  \"bytes\": " << source.text().size() << ",\n"
+            << "  \"tokens\": " << token_count << ",\n"
+            << "  \"runs\": " << runs << ",\n"
+            << "  \"ms_min\": " << best_ms << ",\n"
+            << "  \"mb_per_s_best\": " << megabytes / (best_ms / 1000) << ",\n"
+            << "  \"mb_per_s_mean\": " << megabytes / (total_ms / runs / 1000) << "\n"
+            << "}\n";
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,40 @@
+#include "allocations.hpp"
+
+#include <cstdlib>
+#include <new>
+
+namespace allocations {
+  std::atomic<size_t> count = 0;
+  std::atomic<size_t> bytes = 0;
+}
+
+void* operator new(std::size_t size) {
+  allocations::count.fetch_add(1, std::memory_order_relaxed);
+  allocations::bytes.fetch_add(size, std::memory_order_relaxed);
+
+  if (void* ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
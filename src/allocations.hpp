@@ -0,0 +1,13 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Counts every heap allocation made through operator new, so benchmarks can check that hot
+// loops do not allocate. The replacement operators are defined in allocations.cpp, out of line
+// so the compiler never pairs an inlined operator new with an inlined operator delete.
+namespace allocations {
+  // Atomic so allocations made while parsing in parallel are all counted
+  extern std::atomic<size_t> count;
+  extern std::atomic<size_t> bytes;
+}
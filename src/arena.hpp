@@ -0,0 +1,181 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Bump allocator that owns everything allocated from it and frees it all at once.
+// Objects with destructors are recorded in a list kept inside the arena and destroyed in
+// reverse order when the arena is rewound or destroyed.
+class Arena {
+public:
+  // Position in the arena that can be rewound to, freeing everything allocated after it
+  struct Mark {
+    size_t block = 0;
+    size_t offset = 0;
+    void* cleanups = nullptr;
+  };
+
+  explicit Arena(size_t block_size = 64 * 1024)
+    : m_block_size(block_size)
+  {
+  }
+
+  ~Arena() {
+    rewind(Mark{});
+  }
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  template<typename T, typename... Args>
+  T* make(Args&&... args) {
+    T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      add_cleanup(object, 1);
+    }
+
+    return object;
+  }
+
+  // Default construct count objects in one contiguous allocation
+  template<typename T>
+  T* make_array(size_t count) {
+    if (count == 0) {
+      return nullptr;
+    }
+
+    T* array = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    std::uninitialized_default_construct_n(array, count);
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      add_cleanup(array, count);
+    }
+
+    return array;
+  }
+
+  Mark mark() const {
+    return Mark{ m_block, m_offset, m_cleanups };
+  }
+
+  // Destroy everything allocated since the mark, the memory is kept for reuse
+  void rewind(Mark mark) {
+    while (m_cleanups != mark.cleanups) {
+      Cleanup* cleanup = static_cast<Cleanup*>(m_cleanups);
+      cleanup->destroy(cleanup->object, cleanup->count);
+      m_cleanups = cleanup->next;
+    }
+
+    m_block = mark.block;
+    m_offset = mark.offset;
+  }
+
+  // Keep another arena alive as long as this one, to join trees built in separate arenas
+  void adopt(std::shared_ptr<Arena> arena) {
+    m_adopted.emplace_back(std::move(arena));
+  }
+
+  // Total bytes reserved from the system
+  size_t capacity() const {
+    size_t total = 0;
+    for (const Block& block : m_blocks) {
+      total += block.size;
+    }
+
+    return total;
+  }
+
+  // Arena that Box allocates nodes in, set for a region of code with a Scope
+  static Arena& current() {
+    return *current_slot();
+  }
+
+  // Make an arena current until the scope ends
+  class Scope {
+  public:
+    explicit Scope(Arena& arena)
+      : m_previous(current_slot())
+    {
+      current_slot() = &arena;
+    }
+
+    ~Scope() {
+      current_slot() = m_previous;
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+  private:
+    Arena* m_previous;
+  };
+
+private:
+  struct Block {
+    std::unique_ptr<std::byte[]> data;
+    size_t size;
+  };
+
+  struct Cleanup {
+    void (*destroy)(void*, size_t);
+    void* object;
+    size_t count;
+    void* next;
+  };
+
+  // Nodes created outside of any Scope live for the rest of the program
+  static Arena*& current_slot() {
+    static Arena global;
+    static thread_local Arena* current = &global;
+    return current;
+  }
+
+  void* allocate(size_t size, size_t align) {
+    while (m_block < m_blocks.size()) {
+      Block& block = m_blocks[m_block];
+      size_t offset = (m_offset + align - 1) & ~(align - 1);
+
+      if (offset + size <= block.size) {
+        m_offset = offset + size;
+        return block.data.get() + offset;
+      }
+
+      // Move on to the next block, inserting one if it is too small for the request
+      ++m_block;
+      m_offset = 0;
+      if (m_block < m_blocks.size() && m_blocks[m_block].size < size + align) {
+        m_blocks.insert(m_blocks.begin() + m_block, new_block(size + align));
+      }
+    }
+
+    m_blocks.emplace_back(new_block(size + align));
+    return allocate(size, align);
+  }
+
+  Block new_block(size_t min_size) const {
+    size_t size = std::max(m_block_size, min_size);
+    return Block{ std::make_unique_for_overwrite<std::byte[]>(size), size };
+  }
+
+  template<typename T>
+  void add_cleanup(T* object, size_t count) {
+    Cleanup* cleanup = new (allocate(sizeof(Cleanup), alignof(Cleanup))) Cleanup{
+      [](void* ptr, size_t count) { std::destroy_n(static_cast<T*>(ptr), count); },
+      object, count, m_cleanups
+    };
+
+    m_cleanups = cleanup;
+  }
+
+private:
+  std::vector<Block> m_blocks;
+  size_t m_block_size;
+  size_t m_block = 0;
+  size_t m_offset = 0;
+  void* m_cleanups = nullptr;
+  std::vector<std::shared_ptr<Arena>> m_adopted;
+};
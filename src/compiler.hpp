@@ -0,0 +1,478 @@
+#pragma once
+
+#include "error.hpp"
+#include "operators.hpp"
+#include "values/bytecode.hpp"
+
+#include <bit>
+#include <map>
+#include <unordered_map>
+
+// Lowers a parsed Program into flat bytecode for the VM
+class Compiler {
+public:
+  explicit Compiler(Error& error)
+    : m_error(error), m_chunk(nullptr), m_line(0)
+  {
+  }
+
+  std::shared_ptr<const Chunk> compile(const Program& program) {
+    return compile_function_body(program.stmts, true);
+  }
+
+private:
+  // A statement is compiled whole into one chunk, so a program body moves on to a new chunk
+  // once any of the tables its operands index is half full
+  static constexpr size_t part_limit = UINT16_MAX / 2;
+
+  // Compile a function or program body. The value of a trailing expression is returned.
+  std::shared_ptr<const Chunk> compile_function_body(const std::vector<Stmt>& body, bool program = false) {
+    auto chunk = std::make_shared<Chunk>();
+    Chunk* enclosing = m_chunk;
+    auto enclosing_index = std::exchange(m_index, {});
+    m_chunk = chunk.get();
+
+    for (size_t idx = 0; idx < body.size(); ++idx) {
+      const Stmt& stmt = body[idx];
+
+      if (program && part_full()) {
+        continue_in_new_chunk();
+      }
+
+      if (idx + 1 < body.size()) {
+        compile_stmt(stmt);
+      } else if (stmt.is<Expr>()) {
+        compile_returned_expr(stmt.get<Expr>());
+        emit(OpCode::Return);
+      } else {
+        compile_stmt(stmt);
+        emit(OpCode::Null);
+        emit(OpCode::Return);
+      }
+    }
+
+    emit(OpCode::Null);
+    emit(OpCode::Return);
+
+    m_chunk = enclosing;
+    m_index = std::move(enclosing_index);
+    return chunk;
+  }
+
+  bool part_full() const {
+    return std::max({ m_chunk->constants.size(), m_chunk->names.size(), m_chunk->object_layouts.size(),
+        m_chunk->functions.size(), m_chunk->property_caches.size(), m_chunk->call_caches.size() }) > part_limit;
+  }
+
+  // End the current chunk with a jump into a new one that the rest of the body compiles into
+  void continue_in_new_chunk() {
+    auto next = std::make_shared<Chunk>();
+    emit(OpCode::Continue);
+
+    m_chunk->next = next;
+    m_chunk = next.get();
+    m_index = {};
+  }
+
+  void compile_stmt(const Stmt& stmt) {
+    stmt.visit(overloaded {
+      [this](const Expr& expr) {
+        compile_expr(expr);
+        emit(OpCode::Pop);
+      },
+      [this](const VarDeclaration& declaration) {
+        m_line = declaration.identifier.token.line;
+        if (!declaration.expr.has_value()) {
+          emit(OpCode::DeclareEmpty, add_name(declaration.identifier));
+          return;
+        }
+
+        compile_expr(declaration.expr.value());
+        emit(OpCode::Store, add_name(declaration.identifier));
+      },
+      [this](const VarAssignment& assignment) {
+        compile_expr(assignment.expr);
+        m_line = assignment.identifier.token.line;
+        emit(OpCode::Store, add_name(assignment.identifier));
+      },
+      [this](const FunctionDeclaration& function_dec) {
+        m_line = function_dec.name.token.line;
+        std::shared_ptr<const Chunk> body = compile_function_body(function_dec.body);
+
+        m_chunk->functions.emplace_back(CompiledFunction{ &function_dec, body });
+        emit(OpCode::MakeFunction, m_chunk->functions.size() - 1);
+      },
+      [this](const ConditionalBlock& block) {
+        compile_conditional(block);
+      },
+      [this](const ForLoop& loop) {
+        compile_for_loop(loop);
+      },
+      [this](const WhileLoop& loop) {
+        compile_while_loop(loop);
+      }
+    });
+  }
+
+  void compile_expr(const Expr& expr) {
+    expr.visit(overloaded {
+      [this](const NullLiteral&) {
+        emit(OpCode::Null);
+      },
+      [this](const IntLiteral& literal) {
+        emit_constant(literal, literal.token.line);
+      },
+      [this](const FloatLiteral& literal) {
+        emit_constant(literal, literal.token.line);
+      },
+      [this](const StringLiteral& literal) {
+        emit_constant(literal, literal.token.line);
+      },
+      [this](const BoolLiteral& literal) {
+        emit_constant(literal, literal.token.line);
+      },
+      [this](const Identifier& ident) {
+        m_line = ident.token.line;
+        emit(OpCode::Load, add_name(ident));
+      },
+      [this](const BinaryExpr& bin_expr) {
+        compile_expr(bin_expr.lhs);
+        compile_expr(bin_expr.rhs);
+        m_line = bin_expr.operand.line;
+        emit(binary_op(bin_expr.operand));
+      },
+      [this](const BoolExpr& bool_expr) {
+        compile_bool_expr(bool_expr);
+      },
+      [this](const ObjectLiteral& object) {
+        compile_object_literal(object);
+      },
+      [this](const CallExpr& call_expr) {
+        compile_call_expr(call_expr);
+      },
+      [this](const MemberExpr& member_expr) {
+        compile_member_expr(member_expr);
+      },
+      [this](const Increment& increment) {
+        m_line = increment.identifier.token.line;
+        OpCode op = increment.operand.type == TokenType::Plus ? OpCode::Increment : OpCode::Decrement;
+        emit(op, add_name(increment.identifier));
+      },
+      [this](const ReturnExpr& return_expr) {
+        compile_returned_expr(return_expr.expr);
+        emit(OpCode::Return);
+      }
+    });
+  }
+
+  // Compile a statement used where a value is expected, statements produce null
+  void compile_value(const Stmt& stmt) {
+    if (auto expr = stmt.get_if<Expr>()) {
+      compile_expr(*expr);
+    } else {
+      compile_stmt(stmt);
+      emit(OpCode::Null);
+    }
+  }
+
+  void compile_body(const std::vector<Stmt>& body) {
+    for (const Stmt& stmt : body) {
+      compile_stmt(stmt);
+    }
+  }
+
+  void compile_conditional(const ConditionalBlock& block) {
+    std::vector<size_t> exit_jumps;
+
+    for (const ConditionalStmt& stmt : block.stmts) {
+      // The else statement always runs its body
+      if (!stmt.condition.has_value()) {
+        compile_body(stmt.body);
+        break;
+      }
+
+      compile_bool_expr(stmt.condition.value());
+      size_t next = emit_jump(OpCode::JumpIfFalse);
+
+      compile_body(stmt.body);
+      exit_jumps.emplace_back(emit_jump(OpCode::Jump));
+      patch_jump(next);
+    }
+
+    for (size_t jump : exit_jumps) {
+      patch_jump(jump);
+    }
+  }
+
+  void compile_for_loop(const ForLoop& loop) {
+    m_line = loop.variable.identifier.token.line;
+    uint16_t name = add_name(loop.variable.identifier);
+
+    compile_expr(loop.variable.expr);
+    emit(OpCode::Store, name);
+
+    // Evaluate the loop condition, body and counter
+    size_t loop_start = m_chunk->code.size();
+    auto counted = Operators::counted_loop(loop);
+    size_t exit;
+
+    if (counted.has_value()) {
+      uint16_t bound = add_constant(IntLiteral{ Token{ TokenType::Int, 0 }, counted->bound });
+      m_line = counted->compare.line;
+      emit(OpCode::ForCheck, name);
+      emit_u16(bound);
+      emit_u16(static_cast<uint16_t>(counted->compare.type));
+      exit = emit_u16(0);
+    } else {
+      compile_bool_expr(loop.condition);
+      exit = emit_jump(OpCode::JumpIfFalse);
+    }
+
+    compile_body(loop.body);
+
+    if (counted.has_value()) {
+      m_line = loop.variable.identifier.token.line;
+      emit(OpCode::ForStep, name);
+      emit_u16(static_cast<uint16_t>(counted->step));
+    } else {
+      compile_expr(loop.counter);
+      emit(OpCode::Pop);
+    }
+
+    emit_loop(loop_start);
+    patch_jump(exit);
+
+    // Reset a variable that existed before the loop to its initial value
+    if (!loop.declares_variable) {
+      compile_expr(loop.variable.expr);
+      emit(OpCode::Store, name);
+    }
+  }
+
+  void compile_while_loop(const WhileLoop& loop) {
+    size_t loop_start = m_chunk->code.size();
+    compile_bool_expr(loop.condition);
+    size_t exit = emit_jump(OpCode::JumpIfFalse);
+
+    compile_body(loop.body);
+    emit_loop(loop_start);
+    patch_jump(exit);
+  }
+
+  void compile_bool_expr(const BoolExpr& bool_expr) {
+    compile_expr(bool_expr.lhs);
+    compile_expr(bool_expr.rhs);
+    m_line = bool_expr.operand.line;
+
+    switch (bool_expr.operand.type) {
+      case TokenType::Equals:
+        emit(OpCode::Equal);
+        break;
+      case TokenType::Not:
+        emit(OpCode::NotEqual);
+        break;
+      case TokenType::Greater:
+        emit(OpCode::Greater);
+        break;
+      case TokenType::Less:
+        emit(OpCode::Less);
+        break;
+      case TokenType::GreaterEquals:
+        emit(OpCode::GreaterEqual);
+        break;
+      case TokenType::LessEquals:
+        emit(OpCode::LessEqual);
+        break;
+      case TokenType::And:
+        emit(OpCode::And);
+        break;
+      case TokenType::Or:
+        emit(OpCode::Or);
+        break;
+      default:
+        m_error.report_error("Unsupported operand in boolean expression.", bool_expr.operand);
+    }
+  }
+
+  // The object's shape is found once here, the VM only moves each value into its slot
+  void compile_object_literal(const ObjectLiteral& object) {
+    ObjectLayout layout{ Shape::root(), {} };
+
+    for (const Property& property : object.properties) {
+      Symbol key = property.key.token.symbol;
+      if (layout.shape->find(key) == Shape::not_found) {
+        layout.shape = layout.shape->with(key);
+      }
+      layout.slots.emplace_back(layout.shape->find(key));
+
+      // The resolver gives shorthand properties the variable with the same name as their value
+      compile_expr(property.value.value());
+    }
+
+    m_chunk->object_layouts.emplace_back(std::move(layout));
+    emit(OpCode::MakeObject, m_chunk->object_layouts.size() - 1);
+  }
+
+  // Compile the value a function returns, a call there is in tail position
+  void compile_returned_expr(const Expr& expr) {
+    if (auto call_expr = expr.get_if<CallExpr>()) {
+      compile_call_expr(*call_expr, OpCode::TailCall);
+    } else {
+      compile_expr(expr);
+    }
+  }
+
+  void compile_call_expr(const CallExpr& call_expr, OpCode op = OpCode::Call) {
+    for (const Stmt& arg : call_expr.args) {
+      compile_value(arg);
+    }
+
+    const Identifier& caller = call_expr.caller.get<Identifier>();
+    m_line = caller.token.line;
+    emit(op, add_name(caller));
+    emit_u16(call_expr.args.size());
+    emit_u16(m_chunk->call_caches.size());
+    m_chunk->call_caches.emplace_back();
+  }
+
+  void compile_member_expr(const MemberExpr& member_expr) {
+    m_line = member_expr.object.token.line;
+    emit(OpCode::Load, add_name(member_expr.object));
+
+    // Walk the chain of members, looking each one up in the current object
+    const Expr* member = &member_expr.member;
+    while (auto parent = member->get_if<MemberExpr>()) {
+      m_line = parent->object.token.line;
+      emit_get_member(parent->object);
+      member = &parent->member;
+    }
+
+    const Identifier& key = member->get<Identifier>();
+    m_line = key.token.line;
+    emit_get_member(key);
+  }
+
+  // Every member access gets its own inline cache
+  void emit_get_member(const Identifier& key) {
+    emit(OpCode::GetMember, add_name(key));
+    emit_u16(m_chunk->property_caches.size());
+    m_chunk->property_caches.emplace_back();
+  }
+
+  OpCode binary_op(const Token& operand) {
+    switch (operand.type) {
+      case TokenType::Plus:
+        return OpCode::Add;
+      case TokenType::Minus:
+        return OpCode::Subtract;
+      case TokenType::Star:
+        return OpCode::Multiply;
+      case TokenType::FwdSlash:
+        return OpCode::Divide;
+      case TokenType::Modulo:
+        return OpCode::Modulo;
+      default:
+        m_error.report_error("Invalid operand.", operand);
+    }
+  }
+
+  uint16_t add_name(const Identifier& identifier) {
+    // Names are shared per line and binding so errors still point at the right source line
+    auto [it, inserted] = m_index.names.try_emplace(
+        std::make_tuple(identifier.token.symbol, identifier.token.line, identifier.depth, identifier.slot),
+        m_chunk->names.size());
+    if (inserted) {
+      m_chunk->names.emplace_back(identifier);
+    }
+
+    return checked_operand(it->second);
+  }
+
+  // Literals that print and compare the same share one constant
+  uint16_t add_constant(const RuntimeVal& value) {
+    Token token = value.get_token();
+    uint64_t bits = value.visit(overloaded {
+      [](const IntLiteral& literal) { return static_cast<uint64_t>(literal.value); },
+      [](const FloatLiteral& literal) { return std::bit_cast<uint64_t>(literal.value); },
+      [](const BoolLiteral& literal) { return static_cast<uint64_t>(literal.value); },
+      [](const auto&) { return uint64_t{ 0 }; }
+    });
+
+    int decimals = value.is<FloatLiteral>() ? value.get<FloatLiteral>().decimals : 0;
+
+    std::string key = std::to_string(value.index()) + " " + std::to_string(bits) + " " + std::to_string(decimals) + " " +
+        std::to_string(token.symbol) + (token.raw_value.has_value() ? " " + token.text() : "");
+
+    auto [it, inserted] = m_index.constants.try_emplace(std::move(key), m_chunk->constants.size());
+    if (inserted) {
+      m_chunk->constants.emplace_back(value);
+    }
+
+    return checked_operand(it->second);
+  }
+
+  void emit_constant(const RuntimeVal& value, int line) {
+    m_line = line;
+    emit(OpCode::Constant, add_constant(value));
+  }
+
+  void emit(OpCode op) {
+    m_chunk->code.emplace_back(static_cast<uint8_t>(op));
+    m_chunk->lines.emplace_back(m_line);
+  }
+
+  void emit(OpCode op, size_t operand) {
+    emit(op);
+    emit_u16(operand);
+  }
+
+  // Emit a 16 bit operand and return its offset so it can be patched later
+  size_t emit_u16(size_t operand) {
+    uint16_t value = checked_operand(operand);
+    size_t offset = m_chunk->code.size();
+
+    m_chunk->code.emplace_back(value >> 8);
+    m_chunk->code.emplace_back(value & 0xff);
+    m_chunk->lines.emplace_back(m_line);
+    m_chunk->lines.emplace_back(m_line);
+    return offset;
+  }
+
+  size_t emit_jump(OpCode op) {
+    emit(op);
+    return emit_u16(0);
+  }
+
+  // Point a forward jump at the next instruction
+  void patch_jump(size_t offset) {
+    uint16_t jump = checked_operand(m_chunk->code.size() - offset - 2);
+    m_chunk->code[offset] = jump >> 8;
+    m_chunk->code[offset + 1] = jump & 0xff;
+  }
+
+  void emit_loop(size_t loop_start) {
+    emit(OpCode::Loop);
+    emit_u16(m_chunk->code.size() - loop_start + 2);
+  }
+
+  uint16_t checked_operand(size_t operand) {
+    if (operand > UINT16_MAX) {
+      m_error.report_error("Program is too large to compile.", Token{ TokenType::EndOfFile, m_line });
+    }
+
+    return static_cast<uint16_t>(operand);
+  }
+
+private:
+  Error& m_error;
+  Chunk* m_chunk;
+  int m_line;
+
+  // Where each distinct name and literal is in the current chunk's tables
+  struct Index {
+    std::map<std::tuple<Symbol, int, uint16_t, uint16_t>, size_t> names;
+    std::unordered_map<std::string, size_t> constants;
+  };
+
+  Index m_index;
+};
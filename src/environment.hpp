@@ -1,105 +1,158 @@
 #pragma once
 
 #include "error.hpp"
+#include "trace_stats.hpp"
 #include "values/ast.hpp"
 
+// Storage for the variables of one function call or of the program itself.
+// Slots are assigned by the Resolver, the parent is the frame the function was declared in.
+struct Frame {
+  std::vector<std::optional<RuntimeVal>> slots;
+  std::shared_ptr<Frame> parent;
+};
+
 class Environment {
 public:
-  explicit Environment(Error error)
-    : m_variables(), m_error(std::move(error))
+  // Deepest chain of calls allowed before reporting a stack overflow, calls in tail position
+  // replace their caller so they do not count
+  static constexpr size_t default_max_call_depth = 10000;
+
+  // Create the global environment with the native functions in the first slots
+  explicit Environment(Error& error, size_t slot_count = 0)
+    : m_frame(std::make_shared<Frame>()), m_error(error)
   {
-    define_print_function();
+    m_frame->slots.resize(std::max(slot_count, native_functions().size()));
+    for (size_t slot = 0; slot < native_functions().size(); ++slot) {
+      m_frame->slots[slot] = NativeFunction{ native_functions()[slot].second };
+    }
   }
-   
-  void declare_var(VarDeclaration declaration) {
-    // Check if variable was declared already 
-    if (has_var(declaration.identifier).has_value()) {
-      m_error.report_error("Variable `" + declaration.identifier.token.raw_value.value() +
-          "` is already declared.", declaration.identifier.token);
+
+  // Native functions available to every program, in slot order
+  static const std::vector<std::pair<std::string, NativeFunction::Call>>& native_functions() {
+    static const std::vector<std::pair<std::string, NativeFunction::Call>> natives = {
+      { "print", print }
+    };
+
+    return natives;
+  }
+
+  // Count lookups, stores and frames into the stats when tracing
+  void set_trace(TraceStats* trace) {
+    m_trace = trace;
+  }
+
+  void declare_var(const Identifier& identifier, std::optional<RuntimeVal> value) {
+    if (m_trace) {
+      ++m_trace->stores;
     }
 
-    m_variables.emplace_back(declaration);
+    resolve_slot(identifier) = std::move(value);
   }
 
-  void assign_var(const VarAssignment& assignment) {
-    // Locate the variable
-    auto it = std::find_if(m_variables.begin(), m_variables.end(),
-      [&assignment](const VarDeclaration& var) {
-        return var.identifier.token.raw_value == assignment.identifier.token.raw_value;
-      });
-
-    // If variable was not found, report an error
-    if (it == m_variables.end()) {
-      m_error.report_error("Variable `" + assignment.identifier.token.raw_value.value() +
-          "` was never declared.", assignment.identifier.token);
+  void assign_var(const Identifier& identifier, RuntimeVal value) {
+    if (m_trace) {
+      ++m_trace->stores;
     }
 
-    // If the variable is a constant, report an error
-    if (it->constant) {
-      m_error.report_error("Cannot reassign constant variable `" + 
-          assignment.identifier.token.raw_value.value() + "`.", assignment.identifier.token);
+    resolve_slot(identifier) = std::move(value);
+  }
+
+  const RuntimeVal& search_var(const Identifier& identifier) {
+    if (m_trace) {
+      TraceStats::Timer timer(m_trace->lookups, m_trace->active_node);
+      m_trace->parent_hops += identifier.depth;
+      return find_var(identifier);
     }
 
-    it->expr = assignment.expr;
+    return find_var(identifier);
   }
 
-  std::optional<VarDeclaration> has_var(Identifier identifier) {
-    // Locate the variable
-    auto it = std::find_if(m_variables.begin(), m_variables.end(),
-      [&identifier](const VarDeclaration& variable) {
-        return variable.identifier.token.raw_value == identifier.token.raw_value;
-      });
+  const std::shared_ptr<Frame>& frame() const {
+    return m_frame;
+  }
 
-    // If variable was found, return it
-    if (it != m_variables.end()) {
-      return *it;
+  // Make room for globals declared after the environment was created, when the program is
+  // resolved a statement at a time. Only called between top level statements.
+  void grow_globals(size_t slot_count) {
+    if (m_frame->slots.size() < slot_count) {
+      m_frame->slots.resize(slot_count);
     }
-
-    return {};
   }
 
-  VarDeclaration search_var(Identifier identifier) {
-    if (auto declaration = has_var(identifier); declaration.has_value()) {
-      return declaration.value();
+  // Enter a frame for a function call, reusing a released frame when one is available.
+  // Returns the caller's frame so it can be restored by pop_frame.
+  std::shared_ptr<Frame> push_frame(std::shared_ptr<Frame> parent, size_t slot_count) {
+    std::shared_ptr<Frame> frame;
+    bool reused = !m_free_frames.empty();
+    if (reused) {
+      frame = std::move(m_free_frames.back());
+      m_free_frames.pop_back();
     } else {
-      m_error.report_error("Variable `" + identifier.token.raw_value.value() + "` was never declared in scope.", 
-          identifier.token);
+      frame = std::make_shared<Frame>();
     }
+
+    if (m_trace) {
+      ++m_trace->frames_pushed;
+      m_trace->frames_reused += reused;
+    }
+
+    frame->slots.resize(slot_count);
+    frame->parent = std::move(parent);
+
+    std::shared_ptr<Frame> caller = std::move(m_frame);
+    m_frame = std::move(frame);
+    return caller;
   }
 
-  constexpr size_t size() {
-    return m_variables.size();
+  // Leave the current frame. It is kept for reuse unless a closure still refers to it.
+  void pop_frame(std::shared_ptr<Frame> caller) {
+    if (m_frame.use_count() == 1) {
+      m_frame->slots.clear();
+      m_frame->parent.reset();
+      m_free_frames.emplace_back(std::move(m_frame));
+    }
+
+    m_frame = std::move(caller);
   }
 
-  void restore_scope(const size_t idx) {
-    m_variables.erase(m_variables.begin() + idx, m_variables.end());
+  // Walk up to the frame the identifier was declared in and return its slot
+  std::optional<RuntimeVal>& resolve_slot(const Identifier& identifier) {
+    Frame* frame = m_frame.get();
+    for (uint16_t depth = identifier.depth; depth > 0; --depth) {
+      frame = frame->parent.get();
+    }
+
+    return frame->slots[identifier.slot];
   }
 
 private:
-  void declare_native_function(std::string name, NativeFunction::Call function) {
-    NativeFunction native_fn{ function };
-    VarDeclaration declaration;
-    declaration.identifier.token.raw_value = name;
-    declaration.expr = Expr{ native_fn };
-    declare_var(declaration);
-  }
+  const RuntimeVal& find_var(const Identifier& identifier) {
+    const std::optional<RuntimeVal>& slot = resolve_slot(identifier);
 
-  void define_print_function() {
-    declare_native_function("print", [](const std::vector<RuntimeVal>& args) -> RuntimeVal {
-      for (const RuntimeVal arg : args) {
-        if (arg.is<NullLiteral>()) {
-          continue;
-        }
+    if (!slot.has_value()) {
+      m_error.report_error("Variable `" + identifier.token.text() + "` was never assigned a value.",
+          identifier.token);
+    }
 
-        std::cout << arg.get_token().raw_value.value();
+    return slot.value();
+  }
+
+  static RuntimeVal print(std::span<const RuntimeVal> args) {
+    for (const RuntimeVal& arg : args) {
+      if (arg.is<NullLiteral>()) {
+        continue;
       }
 
-      std::cout << std::endl;
-      return NullLiteral();
-    });
+      std::cout << arg.to_string();
+    }
+
+    std::cout << std::endl;
+    return NullLiteral();
   }
 
 private:
-  std::vector<VarDeclaration> m_variables; 
-  Error m_error;
+  std::shared_ptr<Frame> m_frame;
+  std::vector<std::shared_ptr<Frame>> m_free_frames;
+  Error& m_error;
+  TraceStats* m_trace = nullptr;
 };
@@ -4,101 +4,84 @@
 
 #include <vector>
 #include <iostream>
-#include <unordered_map>
 
 enum class TokenType;
 struct Token;
 
+// Reports errors against the source text. A single instance is shared by reference between
+// every stage, lines are found through an index of line start offsets built once up front.
 class Error {
 public:
-  explicit Error(std::vector<Token> tokens)
-    : m_tokens(std::move(tokens))
+  explicit Error(std::string_view source) {
+    set_source(source);
+  }
+
+  // An error raised by a reporter that defers, for its owner to report once it is safe to exit
+  struct Deferred {
+    std::string message;
+    Token token;
+  };
+
+  // A reporter that throws its first error as Deferred instead of printing it and exiting, so
+  // work on other threads can finish before one error is chosen to report
+  struct Defer {};
+
+  explicit Error(Defer)
+    : m_deferred(true)
   {
   }
 
+  // Show lines from source, which starts at first_line. Streamed input only keeps a window of
+  // the text, lines outside it are shown by number.
+  void set_source(std::string_view source, int first_line = 1) {
+    m_source = source;
+    m_first_line = first_line;
+    m_line_offsets.clear();
+    m_line_offsets.emplace_back(0);
+    for (size_t idx = 0; idx < source.size(); ++idx) {
+      if (source[idx] == '\n') {
+        m_line_offsets.emplace_back(idx + 1);
+      }
+    }
+  }
+
+  Error(const Error&) = delete;
+  Error& operator=(const Error&) = delete;
+
   [[noreturn]] void report_error(const std::string& message, const Token& token) {
+    if (m_deferred) {
+      throw Deferred{ message, token };
+    }
+
     std::string line = extract_line(token.line);
     std::cerr << "Error on line: " << token.line << "\n" << line << "\n\n" << message << "\n";
     exit(EXIT_FAILURE);
   }
 
   static std::string to_string(TokenType type) {
-    static const std::unordered_map<TokenType, std::string> token_type_map = {
-      {TokenType::Let, "let"},
-      {TokenType::Const, "const"},
-      {TokenType::Fn, "function"},
-      {TokenType::If, "if"},
-      {TokenType::Else, "else"},
-      {TokenType::Elif, "elif"},
-      {TokenType::For, "for"},
-      {TokenType::While, "while"},
-      {TokenType::Return, "return"},
-      {TokenType::Null, "null"},
-      {TokenType::Int, "Integer Literal"},
-      {TokenType::Float, "Float Literal"},
-      {TokenType::String, "String Literal"},
-      {TokenType::Identifier, "Identifier"},
-      {TokenType::True, "true"},
-      {TokenType::False, "false"},
-      {TokenType::Plus, "+"},
-      {TokenType::Minus, "-"},
-      {TokenType::Star, "*"},
-      {TokenType::FwdSlash, "/"},
-      {TokenType::Modulo, "%"},
-      {TokenType::Equals, "="},
-      {TokenType::Not, "!"},
-      {TokenType::Greater, ">"},
-      {TokenType::GreaterEquals, ">="},
-      {TokenType::Less, "<"},
-      {TokenType::LessEquals, "<="},
-      {TokenType::And, "&"},
-      {TokenType::Or, "|"},
-      {TokenType::OpenPar, "("},
-      {TokenType::ClosePar, ")"},
-      {TokenType::OpenBrace, "{"},
-      {TokenType::CloseBrace, "}"},
-      {TokenType::OpenBracket, "["},
-      {TokenType::CloseBracket, "]"},
-      {TokenType::Comma, ","},
-      {TokenType::Colon, ":"},
-      {TokenType::Semicol, ";"},
-      {TokenType::Dot, "."},
-      {TokenType::EndOfFile, "eof"}
-    };
-
-    auto it = token_type_map.find(type);
-    if (it != token_type_map.end()) {
-      return it->second;
-    } else {
-      return "";
-    }
+    return std::string(token_names[static_cast<size_t>(type)]);
   }
 
 private:
-  std::string extract_line(const int target_line) {
+  std::string extract_line(const int target_line) const {
     std::string line = std::to_string(target_line) + " | ";
 
-    // Iterate over tokens and append tokens on the target line
-    for (const Token token : m_tokens) {
-      if (token.line == target_line) {
-        // If the token has a raw value, append it to line
-        if (token.raw_value.has_value()) {
-          line += token.raw_value.value() + " ";
-          continue;
-        }
-
-        // If the token does not have a raw value, append its type
-        line += to_string(token.type) + " ";
-      }
-      
-      else if (token.line > target_line)
-      break;
+    // Lines are numbered from 1, out of range lines only show the number
+    int index = target_line - m_first_line;
+    if (index < 0 || static_cast<size_t>(index) >= m_line_offsets.size()) {
+      return line;
     }
 
+    size_t start = m_line_offsets[index];
+    size_t end = m_source.find('\n', start);
+    line += m_source.substr(start, end == std::string_view::npos ? end : end - start);
     return line;
   }
 
 private:
-  const std::vector<Token> m_tokens;
+  std::string_view m_source;
+  int m_first_line = 1;
+  std::vector<size_t> m_line_offsets;
+  bool m_deferred = false;
 };
 
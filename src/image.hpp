@@ -0,0 +1,615 @@
+#pragma once
+
+#include "values/ast.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+// Binary image of a resolved and optimized Program, written next to its source by
+// `paint --compile` and loaded instead of tokenizing, parsing, resolving and optimizing the
+// source while the source is unchanged. Text in the image is viewed in place, so the mapped
+// image must outlive the program loaded from it.
+//
+// Layout: the magic bytes, version, source size and hash, hash of the rest, then a table of every string used by
+// a token, then the program's nodes in depth first order. Counts, lines, slots and string ids
+// are variable length integers, seven bits to a byte, other values are in native byte order.
+class Image {
+public:
+  // Bump whenever the layout of the image or of the AST changes
+  static constexpr uint32_t version = 2;
+  static constexpr char magic[8] = { 'W', 'E', 'T', 'P', 'A', 'I', 'N', 'T' };
+
+  // The image of foo.wp is foo.wpc
+  static std::string path_for(const std::string& source_path) {
+    return source_path + "c";
+  }
+
+  static void save(const std::string& path, const Program& program, std::string_view source) {
+    Writer writer;
+    std::string image = writer.write(program, source);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.write(image.data(), image.size())) {
+      std::cerr << "Could not write image: " << path << "\n";
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
+  // The program in the image, or nothing when the image is damaged or was compiled by another
+  // version or from different source
+  static std::optional<Program> load(std::string_view image, std::string_view source) {
+    Reader reader(image);
+    return reader.read(source);
+  }
+
+  // FNV-1a of the source text
+  static uint64_t hash(std::string_view text) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (char c : text) {
+      hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3;
+    }
+
+    return hash;
+  }
+
+private:
+  // Nodes are written by the index of their alternative, a new alternative needs a new version
+  static_assert(Expr::alternatives == 13 && Stmt::alternatives == 7, "AST changed, update Image and its version");
+
+  class Writer {
+  public:
+    std::string write(const Program& program, std::string_view source) {
+      write_varint(program.slot_count);
+      write_stmts(program.stmts);
+      std::string nodes = std::move(m_out);
+
+      write_varint(m_strings.size());
+      for (std::string_view text : m_strings) {
+        write_varint(text.size());
+        m_out.append(text);
+      }
+      m_out.append(nodes);
+      std::string body = std::move(m_out);
+
+      m_out.append(magic, sizeof(magic));
+      write_value(version);
+      write_value(static_cast<uint64_t>(source.size()));
+      write_value(hash(source));
+      write_value(hash(body));
+      m_out.append(body);
+      return std::move(m_out);
+    }
+
+  private:
+    template<typename T>
+    void write_value(T value) {
+      m_out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void write_varint(uint64_t value) {
+      while (value >= 0x80) {
+        m_out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+      }
+      m_out.push_back(static_cast<char>(value));
+    }
+
+    uint64_t string_id(std::string_view text) {
+      auto [it, added] = m_string_ids.try_emplace(text, m_strings.size());
+      if (added) {
+        m_strings.emplace_back(text);
+      }
+
+      return it->second;
+    }
+
+    // Text is written as one more than its string id, zero when there is none. Symbols are
+    // stored as their text and interned again when loaded, one means the same text as the token.
+    void write_token(const Token& token) {
+      write_value(static_cast<uint8_t>(token.type));
+      write_varint(token.line);
+      write_varint(token.raw_value.has_value() ? string_id(*token.raw_value) + 1 : 0);
+
+      if (token.symbol == SymbolTable::empty) {
+        write_varint(0);
+      } else if (token.raw_value == SymbolTable::global().name(token.symbol)) {
+        write_varint(1);
+      } else {
+        write_varint(string_id(SymbolTable::global().name(token.symbol)) + 2);
+      }
+    }
+
+    void write_identifier(const Identifier& identifier) {
+      write_token(identifier.token);
+      write_varint(identifier.depth);
+      write_varint(identifier.slot);
+    }
+
+    void write_stmts(const std::vector<Stmt>& stmts) {
+      write_varint(stmts.size());
+      for (const Stmt& stmt : stmts) {
+        write_stmt(stmt);
+      }
+    }
+
+    void write_optional(const std::optional<Expr>& expr) {
+      write_value(static_cast<uint8_t>(expr.has_value()));
+      if (expr.has_value()) {
+        write_expr(expr.value());
+      }
+    }
+
+    void write_bool_expr(const BoolExpr& bool_expr) {
+      write_expr(bool_expr.lhs);
+      write_expr(bool_expr.rhs);
+      write_token(bool_expr.operand);
+    }
+
+    void write_stmt(const Stmt& stmt) {
+      write_value(static_cast<uint8_t>(stmt.index()));
+      stmt.visit(overloaded {
+        [this](const Expr& expr) {
+          write_expr(expr);
+        },
+        [this](const VarDeclaration& declaration) {
+          write_identifier(declaration.identifier);
+          write_optional(declaration.expr);
+          write_value(static_cast<uint8_t>(declaration.constant));
+        },
+        [this](const VarAssignment& assignment) {
+          write_identifier(assignment.identifier);
+          write_expr(assignment.expr);
+        },
+        [this](const FunctionDeclaration& function_dec) {
+          // The slot count comes first so the reader can check the slots the body uses
+          write_identifier(function_dec.name);
+          write_varint(function_dec.slot_count);
+          write_varint(function_dec.params.size());
+          for (const Identifier& param : function_dec.params) {
+            write_identifier(param);
+          }
+          write_stmts(function_dec.body);
+          write_value(static_cast<uint8_t>(function_dec.pure));
+        },
+        [this](const ConditionalBlock& block) {
+          write_varint(block.stmts.size());
+          for (const ConditionalStmt& conditional : block.stmts) {
+            write_value(static_cast<uint8_t>(conditional.type));
+            write_stmts(conditional.body);
+            write_value(static_cast<uint8_t>(conditional.condition.has_value()));
+            if (conditional.condition.has_value()) {
+              write_bool_expr(conditional.condition.value());
+            }
+          }
+        },
+        [this](const ForLoop& loop) {
+          write_identifier(loop.variable.identifier);
+          write_expr(loop.variable.expr);
+          write_bool_expr(loop.condition);
+          write_expr(loop.counter);
+          write_stmts(loop.body);
+          write_value(static_cast<uint8_t>(loop.declares_variable));
+        },
+        [this](const WhileLoop& loop) {
+          write_bool_expr(loop.condition);
+          write_stmts(loop.body);
+        }
+      });
+    }
+
+    void write_expr(const Expr& expr) {
+      write_value(static_cast<uint8_t>(expr.index()));
+      expr.visit(overloaded {
+        [](const NullLiteral&) {},
+        [this](const Identifier& identifier) {
+          write_identifier(identifier);
+        },
+        [this](const IntLiteral& literal) {
+          write_token(literal.token);
+          write_value(literal.value);
+        },
+        [this](const FloatLiteral& literal) {
+          write_token(literal.token);
+          write_value(literal.value);
+        },
+        [this](const StringLiteral& literal) {
+          write_token(literal.token);
+        },
+        [this](const BoolLiteral& literal) {
+          write_value(static_cast<uint8_t>(literal.value));
+          write_token(literal.token);
+        },
+        [this](const BinaryExpr& binary_expr) {
+          write_expr(binary_expr.lhs);
+          write_expr(binary_expr.rhs);
+          write_token(binary_expr.operand);
+        },
+        [this](const BoolExpr& bool_expr) {
+          write_bool_expr(bool_expr);
+        },
+        [this](const ObjectLiteral& object) {
+          write_varint(object.properties.size());
+          for (const Property& property : object.properties) {
+            write_identifier(property.key);
+            write_expr(property.value.value());
+          }
+        },
+        [this](const CallExpr& call) {
+          write_stmts(call.args);
+          write_expr(call.caller);
+        },
+        [this](const MemberExpr& member) {
+          write_identifier(member.object);
+          write_expr(member.member);
+        },
+        [this](const Increment& increment) {
+          write_identifier(increment.identifier);
+          write_token(increment.operand);
+        },
+        [this](const ReturnExpr& return_expr) {
+          write_expr(return_expr.expr);
+        }
+      });
+    }
+
+  private:
+    std::string m_out;
+    std::vector<std::string_view> m_strings;
+    std::unordered_map<std::string_view, uint32_t> m_string_ids;
+  };
+
+  // Reads are bounds checked, and the program is checked to be one the resolver could have
+  // produced: every variable is in a frame that exists and a slot within it, and nodes the engines
+  // take apart have the kinds they expect. A damaged image sets m_failed and is rejected once read.
+  class Reader {
+  public:
+    explicit Reader(std::string_view image)
+      : m_image(image)
+    {
+    }
+
+    std::optional<Program> read(std::string_view source) {
+      if (m_image.size() < sizeof(magic) || std::memcmp(m_image.data(), magic, sizeof(magic)) != 0) {
+        return std::nullopt;
+      }
+
+      m_pos = sizeof(magic);
+      if (read_value<uint32_t>() != version || read_value<uint64_t>() != source.size() ||
+          read_value<uint64_t>() != hash(source)) {
+        return std::nullopt;
+      }
+
+      uint64_t body_hash = read_value<uint64_t>();
+      if (m_failed || body_hash != hash(m_image.substr(m_pos))) {
+        return std::nullopt;
+      }
+
+      size_t string_count = read_count();
+      for (size_t idx = 0; idx < string_count && !m_failed; ++idx) {
+        m_strings.emplace_back(take(read_varint()));
+      }
+      m_symbols.assign(m_strings.size(), std::nullopt);
+
+      Program program;
+      program.arena = std::make_shared<Arena>();
+      Arena::Scope scope(*program.arena);
+
+      program.slot_count = read_slot_count();
+      m_frames.emplace_back(program.slot_count);
+      program.stmts = read_stmts();
+
+      if (m_failed || m_pos != m_image.size()) {
+        return std::nullopt;
+      }
+
+      return program;
+    }
+
+  private:
+    template<typename T>
+    T read_value() {
+      T value{};
+      std::string_view bytes = take(sizeof(T));
+      if (!m_failed) {
+        std::memcpy(&value, bytes.data(), sizeof(T));
+      }
+
+      return value;
+    }
+
+    std::string_view take(size_t size) {
+      if (m_failed || size > m_image.size() - m_pos) {
+        m_failed = true;
+        return {};
+      }
+
+      std::string_view bytes = m_image.substr(m_pos, size);
+      m_pos += size;
+      return bytes;
+    }
+
+    uint64_t read_varint() {
+      uint64_t value = 0;
+      for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte = read_value<uint8_t>();
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0 || m_failed) {
+          return value;
+        }
+      }
+
+      m_failed = true;
+      return 0;
+    }
+
+    // Every element takes at least a byte, so a larger count can only come from a damaged image
+    size_t read_count() {
+      uint64_t count = read_varint();
+      if (count > m_image.size() - m_pos) {
+        m_failed = true;
+        return 0;
+      }
+
+      return count;
+    }
+
+    std::string_view string_at(uint64_t id) {
+      if (id >= m_strings.size()) {
+        m_failed = true;
+        return {};
+      }
+
+      return m_strings[id];
+    }
+
+    // Each string is interned once, however many tokens use it
+    Symbol intern(uint64_t id) {
+      if (id >= m_strings.size()) {
+        m_failed = true;
+        return SymbolTable::empty;
+      }
+
+      if (!m_symbols[id].has_value()) {
+        m_symbols[id] = SymbolTable::global().intern(m_strings[id]);
+      }
+
+      return m_symbols[id].value();
+    }
+
+    // Slots are 16 bit, so a frame never has more
+    size_t read_slot_count() {
+      uint64_t slot_count = read_varint();
+      if (slot_count > UINT16_MAX + 1) {
+        m_failed = true;
+        return 0;
+      }
+
+      return slot_count;
+    }
+
+    TokenType read_type() {
+      uint8_t type = read_value<uint8_t>();
+      if (type >= token_names.size()) {
+        m_failed = true;
+        return TokenType::EndOfFile;
+      }
+
+      return static_cast<TokenType>(type);
+    }
+
+    Token read_token() {
+      Token token{ read_type(), static_cast<int>(read_varint()) };
+
+      uint64_t text = read_varint();
+      if (text != 0) {
+        token.raw_value = string_at(text - 1);
+      }
+
+      uint64_t symbol = read_varint();
+      if (symbol == 1 && text != 0) {
+        token.symbol = intern(text - 1);
+      } else if (symbol > 1) {
+        token.symbol = intern(symbol - 2);
+      }
+
+      return token;
+    }
+
+    // Property names carry a location that is never used, so only its size is checked
+    Identifier read_identifier() {
+      Identifier identifier{ read_token() };
+      uint64_t depth = read_varint();
+      uint64_t slot = read_varint();
+      if (depth > UINT16_MAX || slot > UINT16_MAX) {
+        m_failed = true;
+      }
+
+      identifier.depth = depth;
+      identifier.slot = slot;
+      return identifier;
+    }
+
+    // A variable must be in one of the enclosing functions' frames, within its slots
+    Identifier read_variable() {
+      Identifier variable = read_identifier();
+      if (variable.depth >= m_frames.size() || variable.slot >= m_frames[m_frames.size() - 1 - variable.depth]) {
+        m_failed = true;
+      }
+
+      return variable;
+    }
+
+    // The member of a member expression is a property name, or another member expression whose
+    // object is the next property name in the chain
+    Expr read_member() {
+      switch (read_value<uint8_t>()) {
+        case 1:
+          return read_identifier();
+        case 10: {
+          Identifier key = read_identifier();
+          return MemberExpr{ key, read_member() };
+        }
+        default:
+          m_failed = true;
+          return NullLiteral();
+      }
+    }
+
+    std::vector<Stmt> read_stmts() {
+      std::vector<Stmt> stmts(read_count());
+      for (Stmt& stmt : stmts) {
+        stmt = read_stmt();
+      }
+
+      return stmts;
+    }
+
+    std::optional<Expr> read_optional() {
+      if (read_value<uint8_t>() == 0) {
+        return std::nullopt;
+      }
+
+      return read_expr();
+    }
+
+    BoolExpr read_bool_expr() {
+      Expr lhs = read_expr();
+      Expr rhs = read_expr();
+      return BoolExpr{ lhs, rhs, read_token() };
+    }
+
+    Stmt read_stmt() {
+      switch (read_value<uint8_t>()) {
+        case 0:
+          return read_expr();
+        case 1: {
+          VarDeclaration declaration;
+          declaration.identifier = read_variable();
+          declaration.expr = read_optional();
+          declaration.constant = read_value<uint8_t>();
+          return declaration;
+        }
+        case 2: {
+          Identifier identifier = read_variable();
+          return VarAssignment{ identifier, read_expr() };
+        }
+        case 3: {
+          FunctionDeclaration function_dec;
+          // The name is declared in the enclosing frame, the parameters and body use the function's own
+          function_dec.name = read_variable();
+          function_dec.slot_count = read_slot_count();
+          m_frames.emplace_back(function_dec.slot_count);
+          function_dec.params.resize(read_count());
+          for (Identifier& param : function_dec.params) {
+            param = read_variable();
+          }
+          function_dec.body = read_stmts();
+          m_frames.pop_back();
+          function_dec.pure = read_value<uint8_t>();
+          return function_dec;
+        }
+        case 4: {
+          ConditionalBlock block;
+          block.stmts.resize(read_count());
+          for (ConditionalStmt& conditional : block.stmts) {
+            conditional.type = read_type();
+            conditional.body = read_stmts();
+            if (read_value<uint8_t>() != 0) {
+              conditional.condition = read_bool_expr();
+            }
+          }
+          return block;
+        }
+        case 5: {
+          ForLoop loop;
+          loop.variable.identifier = read_variable();
+          loop.variable.expr = read_expr();
+          loop.condition = read_bool_expr();
+          loop.counter = read_expr();
+          loop.body = read_stmts();
+          loop.declares_variable = read_value<uint8_t>();
+          return loop;
+        }
+        case 6: {
+          BoolExpr condition = read_bool_expr();
+          return WhileLoop{ condition, read_stmts() };
+        }
+        default:
+          m_failed = true;
+          return Expr{ NullLiteral() };
+      }
+    }
+
+    Expr read_expr() {
+      switch (read_value<uint8_t>()) {
+        case 0:
+          return NullLiteral();
+        case 1:
+          return read_variable();
+        case 2: {
+          Token token = read_token();
+          return IntLiteral{ token, read_value<int64_t>() };
+        }
+        case 3: {
+          Token token = read_token();
+          return FloatLiteral{ token, read_value<double>() };
+        }
+        case 4:
+          return StringLiteral{ read_token() };
+        case 5: {
+          bool value = read_value<uint8_t>();
+          return BoolLiteral{ value, read_token() };
+        }
+        case 6: {
+          Expr lhs = read_expr();
+          Expr rhs = read_expr();
+          return BinaryExpr{ lhs, rhs, read_token() };
+        }
+        case 7:
+          return read_bool_expr();
+        case 8: {
+          ObjectLiteral object;
+          object.properties.resize(read_count());
+          for (Property& property : object.properties) {
+            property.key = read_identifier();
+            property.value = read_expr();
+          }
+          return object;
+        }
+        case 9: {
+          // Functions are only ever called by name
+          std::vector<Stmt> args = read_stmts();
+          Expr caller = read_expr();
+          if (!caller.is<Identifier>()) {
+            m_failed = true;
+          }
+          return CallExpr{ args, caller };
+        }
+        case 10: {
+          Identifier object = read_variable();
+          return MemberExpr{ object, read_member() };
+        }
+        case 11: {
+          Identifier identifier = read_variable();
+          return Increment{ identifier, read_token() };
+        }
+        case 12:
+          return ReturnExpr{ read_expr() };
+        default:
+          m_failed = true;
+          return NullLiteral();
+      }
+    }
+
+  private:
+    std::string_view m_image;
+    size_t m_pos = 0;
+    bool m_failed = false;
+    std::vector<std::string_view> m_strings;
+    std::vector<std::optional<Symbol>> m_symbols;
+    // Slot count of each enclosing function's frame, the innermost last
+    std::vector<size_t> m_frames;
+  };
+};
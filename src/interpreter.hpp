@@ -1,124 +1,206 @@
 #pragma once
 
 #include "environment.hpp"
+#include "memo_cache.hpp"
+#include "operators.hpp"
+#include "profiler.hpp"
+#include "statement_stream.hpp"
+#include "trace_stats.hpp"
 
-#include <variant>
+#include <pthread.h>
+#include <sys/mman.h>
 
 class Interpreter {
 public:
-  explicit Interpreter(Program program, Error error, Environment env)
-    : m_program(std::move(program)), m_error(std::move(error)), m_env(std::move(env)) 
+  explicit Interpreter(Program program, Error& error, Environment env)
+    : m_program(std::move(program)), m_error(error), m_env(std::move(env)), m_operators(m_error)
   {
   }
 
   RuntimeVal evaluate_program() {
+    if (m_profiler) {
+      m_profile_stack.emplace_back(ProfileFrame{ SymbolTable::empty, 0, nullptr });
+    }
+
+    // Calls recurse on the native stack, so the program runs on a thread with a stack reserved
+    // for the deepest chain of calls allowed
+    RuntimeVal result;
+    auto run = [this, &result]() { result = eval_function_body(m_program.stmts); };
+    run_with_stack(run);
+    return result;
+  }
+
+  // Run each top level statement as soon as the stream has read it, stopping at a top level
+  // return like evaluate_program
+  RuntimeVal evaluate_stream(StatementStream& stream) {
+    if (m_profiler) {
+      m_profile_stack.emplace_back(ProfileFrame{ SymbolTable::empty, 0, nullptr });
+    }
+
+    RuntimeVal result{ NullLiteral() };
+    auto run = [this, &stream, &result]() {
+      while (std::optional<Stmt> stmt = stream.next()) {
+        m_env.grow_globals(stream.global_slot_count());
+        result = evaluate(stmt.value());
+
+        if (m_return_value.has_value()) {
+          result = std::move(m_return_value.value());
+          m_return_value.reset();
+          break;
+        }
+      }
+    };
+
+    run_with_stack(run);
+    return result;
+  }
+
+  void set_max_call_depth(size_t depth) {
+    m_max_call_depth = depth;
+  }
+
+  // Look calls to pure functions up in the cache and store their results
+  void set_memo(MemoCache* memo) {
+    m_memo = memo;
+  }
+
+  // Count and time every node and line executed, and the environment's lookups
+  void set_trace(TraceStats* trace) {
+    m_trace = trace;
+    m_env.set_trace(trace);
+  }
+
+  // Keep a shadow stack of calls and sample it whenever the profiler's timer has fired
+  void set_profiler(Profiler* profiler) {
+    m_profiler = profiler;
+  }
+
+private:
+  // Run the statements of a program or function body, returning the value of a return
+  // statement or otherwise the value of the last statement
+  RuntimeVal eval_function_body(const std::vector<Stmt>& body) {
     RuntimeVal last_eval{ NullLiteral() };
 
-    for (Stmt stmt : m_program.stmts) {
-      last_eval = evaluate(stmt);
+    for (const Stmt& stmt : body) {
+      // The value of the last statement is returned
+      last_eval = evaluate(stmt, &stmt == &body.back());
 
-      if (last_eval.is<ReturnExpr>()) {
-        return eval_expr(last_eval.get<ReturnExpr>().expr);
+      // Stop at a return statement and hand back its value
+      if (m_return_value.has_value()) {
+        last_eval = std::move(m_return_value.value());
+        m_return_value.reset();
+        break;
       }
     }
 
     return last_eval;
   }
 
-private:
-  RuntimeVal evaluate(Stmt stmt) {
-    if (stmt.is<Expr>()) {
-      Expr expr = stmt.get<Expr>();
-      if (expr.is<ReturnExpr>()) {
-        return expr.get<ReturnExpr>();
+  RuntimeVal evaluate(const Stmt& stmt, bool returned = false) {
+    if (m_profiler) {
+      m_profile_stack.back().stmt = &stmt;
+      if (Profiler::pending()) {
+        sample();
       }
-
-      return eval_expr(expr);
-    }
-    else if (stmt.is<VarDeclaration>()) {
-      m_env.declare_var(stmt.get<VarDeclaration>());
-      return NullLiteral();
     }
-    else if (stmt.is<VarAssignment>()) {
-      m_env.assign_var(stmt.get<VarAssignment>());
-      return NullLiteral();
-    }
-    else if (stmt.is<FunctionDeclaration>()) {
-      FunctionDeclaration function_dec = stmt.get<FunctionDeclaration>(); 
-      std::shared_ptr<Environment> env = std::make_shared<Environment>(m_env);
 
-      Function function{ function_dec, env };
-      m_env.declare_var(VarDeclaration{ function_dec.name, function, true });
-      return NullLiteral();
-    }
-    else if (stmt.is<ConditionalBlock>()) {
-      return eval_conditional(stmt.get<ConditionalBlock>());
-    }
-    else if (stmt.is<ForLoop>()) {
-      return eval_for_loop(stmt.get<ForLoop>());
-    }
-    else if (stmt.is<WhileLoop>()) {
-      return eval_while_loop(stmt.get<WhileLoop>());
-    }
-    else {
-      return NullLiteral();
+    if (m_trace) {
+      TraceStats::Timer line_timer(m_trace->lines[line_of(stmt)], m_trace->active_line);
+      if (stmt.is<Expr>()) {
+        return eval_stmt(stmt, returned);
+      }
+
+      TraceStats::Timer kind_timer(m_trace->stmts[stmt.index()], m_trace->active_node);
+      return eval_stmt(stmt, returned);
     }
+
+    return eval_stmt(stmt, returned);
   }
 
-  RuntimeVal eval_expr(Expr expr) {
-    // Map for handling literals
-    static const std::unordered_map<std::type_index, std::function<RuntimeVal(const Expr&)>> literals {
-      { typeid(IntLiteral), [](const Expr& e) { return e.get<IntLiteral>(); } },
-      { typeid(FloatLiteral), [](const Expr& e) { return e.get<FloatLiteral>(); } },
-      { typeid(StringLiteral), [](const Expr& e) { return e.get<StringLiteral>(); } },
-      { typeid(BoolLiteral), [](const Expr& e) { return e.get<BoolLiteral>(); } },
-      { typeid(NullLiteral), [](const Expr&) { return NullLiteral(); } }
-    };
+  RuntimeVal eval_stmt(const Stmt& stmt, bool returned) {
+    return stmt.visit(overloaded {
+      [this, returned](const Expr& expr) -> RuntimeVal {
+        return returned ? eval_returned(expr) : eval_expr(expr);
+      },
+      [this](const VarDeclaration& declaration) -> RuntimeVal {
+        std::optional<RuntimeVal> value;
+        if (declaration.expr.has_value()) {
+          value = eval_expr(declaration.expr.value());
+        }
+
+        m_env.declare_var(declaration.identifier, std::move(value));
+        return NullLiteral();
+      },
+      [this](const VarAssignment& assignment) -> RuntimeVal {
+        m_env.assign_var(assignment.identifier, eval_expr(assignment.expr));
+        return NullLiteral();
+      },
+      [this](const FunctionDeclaration& function_dec) -> RuntimeVal {
+        Function function{ &function_dec, m_env.frame() };
+        m_env.declare_var(function_dec.name, std::move(function));
+        return NullLiteral();
+      },
+      [this](const ConditionalBlock& block) -> RuntimeVal {
+        return eval_conditional(block);
+      },
+      [this](const ForLoop& loop) -> RuntimeVal {
+        return eval_for_loop(loop);
+      },
+      [this](const WhileLoop& loop) -> RuntimeVal {
+        return eval_while_loop(loop);
+      }
+    });
+  }
 
-    // Get the value of literal types
-    auto it = literals.find(expr.type());
-    if (it != literals.end()) {
-      return it->second(expr);
+  RuntimeVal eval_expr(const Expr& expr) {
+    if (m_trace) {
+      TraceStats::Timer timer(m_trace->exprs[expr.index()], m_trace->active_node);
+      return eval_expr_node(expr);
     }
 
-    // Handle Identifier
-    if (expr.is<Identifier>()) {
-      Identifier ident = expr.get<Identifier>();
-      return eval_expr(m_env.search_var(ident).expr.value());
-    }
-    // Handle other expression types
-    else if (expr.is<BinaryExpr>()) {
-      return eval_bin_expr(expr.get<BinaryExpr>());
-    }
-    else if (expr.is<BoolExpr>()) {
-      bool boolean = eval_bool_expr(expr.get<BoolExpr>());
-      Token token = boolean ? Token{ TokenType::True, 0, "true" } 
-                            : Token{ TokenType::False, 0, "false" };
-      return BoolLiteral{ boolean, token };
-    }
-    else if (expr.is<ObjectLiteral>()) {
-      return eval_object_literal(expr.get<ObjectLiteral>());
-    }
-    else if (expr.is<CallExpr>()) {
-      return eval_call_expr(expr.get<CallExpr>());
-    }
-    else if (expr.is<MemberExpr>()) {
-      return eval_member_expr(expr.get<MemberExpr>());
-    }
-    else if (expr.is<Increment>()) {
-      return eval_increment(expr.get<Increment>());
-    }
-    else if (expr.is<RuntimeVal>()) {
-      return expr.get<RuntimeVal>();
-    }
-    else {
-      return NullLiteral();
-    }
+    return eval_expr_node(expr);
+  }
+
+  RuntimeVal eval_expr_node(const Expr& expr) {
+    return expr.visit(overloaded {
+      // Literals evaluate to themselves
+      [](const NullLiteral&) -> RuntimeVal { return NullLiteral(); },
+      [](const IntLiteral& literal) -> RuntimeVal { return literal; },
+      [](const FloatLiteral& literal) -> RuntimeVal { return literal; },
+      [](const StringLiteral& literal) -> RuntimeVal { return literal; },
+      [](const BoolLiteral& literal) -> RuntimeVal { return literal; },
+      [this](const Identifier& ident) -> RuntimeVal {
+        return m_env.search_var(ident);
+      },
+      [this](const BinaryExpr& bin_expr) -> RuntimeVal {
+        return eval_bin_expr(bin_expr);
+      },
+      [this](const BoolExpr& bool_expr) -> RuntimeVal {
+        return Operators::make_bool(eval_bool_expr(bool_expr));
+      },
+      [this](const ObjectLiteral& object) -> RuntimeVal {
+        return eval_object_literal(object);
+      },
+      [this](const CallExpr& call_expr) -> RuntimeVal {
+        return eval_call_expr(call_expr);
+      },
+      [this](const MemberExpr& member_expr) -> RuntimeVal {
+        return eval_member_expr(member_expr);
+      },
+      [this](const Increment& increment) -> RuntimeVal {
+        return eval_increment(increment);
+      },
+      // Record the value so the enclosing bodies stop executing
+      [this](const ReturnExpr& return_expr) -> RuntimeVal {
+        m_return_value = eval_returned(return_expr.expr);
+        return NullLiteral();
+      }
+    });
   }
 
-  RuntimeVal eval_conditional(ConditionalBlock block) {
-    for (ConditionalStmt stmt : block.stmts) {
-      // Check if the statement's condition has no value or evaluates to true     
+  RuntimeVal eval_conditional(const ConditionalBlock& block) {
+    for (const ConditionalStmt& stmt : block.stmts) {
+      // Check if the statement's condition has no value or evaluates to true
       if (!stmt.condition.has_value() || eval_bool_expr(stmt.condition.value())) {
         eval_body(stmt.body);
         return NullLiteral();
@@ -128,293 +210,408 @@ private:
     return NullLiteral();
   }
 
-  RuntimeVal eval_for_loop(ForLoop loop) {
-    VarAssignment variable = loop.variable;
-    bool variable_exists = m_env.has_var(variable.identifier).has_value();
+  RuntimeVal eval_for_loop(const ForLoop& loop) {
+    const VarAssignment& variable = loop.variable;
+    m_env.declare_var(variable.identifier, eval_expr(variable.expr));
 
-    // Declare the variable if it doesn't already exist
-    if (!variable_exists) {
-      VarDeclaration declaration{ variable.identifier, variable.expr, false };
-      m_env.declare_var(declaration);
+    auto counted = Operators::counted_loop(loop);
+    if (counted.has_value()) {
+      eval_counted_loop(loop, counted.value());
+    } else {
+      // Evaluate the loop condition and body
+      while (eval_bool_expr(loop.condition)) {
+        eval_body(loop.body);
+        if (m_return_value.has_value()) {
+          break;
+        }
+
+        eval_expr(loop.counter);
+      }
     }
-    
-    m_env.assign_var(variable);
 
-    // Evaluate the loop condition and body
-    while (eval_bool_expr(loop.condition)) {
-      eval_body(loop.body);
-      eval_expr(loop.counter);
+    // Reset a variable that existed before the loop to its initial value. A return from the body
+    // leaves the function at once, as in the VM, so nothing runs before the caller picks up the
+    // return value and any tail call.
+    if (!loop.declares_variable && !m_return_value.has_value()) {
+      m_env.assign_var(variable.identifier, eval_expr(variable.expr));
     }
 
-    // Restore the environment to its original state
-    if (!variable_exists) {
-      m_env.restore_scope(m_env.size() - 1);
-    } else {
-      m_env.assign_var(variable);
-    }
+    return NullLiteral();
+  }
+
+  // Test and step the counter in place while it holds an integer, falling back to the generic
+  // condition and increment if the body stores anything else in it
+  void eval_counted_loop(const ForLoop& loop, const Operators::CountedLoop& counted) {
+    std::optional<RuntimeVal>& slot = m_env.resolve_slot(loop.variable.identifier);
 
-    return NullLiteral();    
+    while (true) {
+      IntLiteral* counter = slot.has_value() ? slot->get_if<IntLiteral>() : nullptr;
+      bool running = counter
+        ? Operators::compare_int(counter->value, counted.bound, counted.compare.type)
+        : eval_bool_expr(loop.condition);
+
+      if (!running) {
+        break;
+      }
+
+      eval_body(loop.body);
+      if (m_return_value.has_value()) {
+        break;
+      }
+
+      counter = slot.has_value() ? slot->get_if<IntLiteral>() : nullptr;
+      if (counter) {
+        counter->value += counted.step;
+        counter->token.raw_value.reset();
+      } else {
+        eval_expr(loop.counter);
+      }
+    }
   }
 
-  RuntimeVal eval_while_loop(WhileLoop loop) {
-    // Evaluate the loop condition and body   
+  RuntimeVal eval_while_loop(const WhileLoop& loop) {
+    // Evaluate the loop condition and body
     while (eval_bool_expr(loop.condition)) {
       eval_body(loop.body);
+      if (m_return_value.has_value()) {
+        break;
+      }
     }
 
     return NullLiteral();
   }
 
-  void eval_body(std::vector<Stmt> body) {
-    // Save the current size of the environment stack
-    size_t size = m_env.size();    
-
-    for (Stmt stmt : body) {
+  void eval_body(const std::vector<Stmt>& body) {
+    for (const Stmt& stmt : body) {
       evaluate(stmt);
+      if (m_return_value.has_value()) {
+        break;
+      }
+    }
+  }
+
+  RuntimeVal eval_object_literal(const ObjectLiteral& object) {
+    Object result;
+
+    result.values.reserve(object.properties.size());
+
+    for (const Property& property : object.properties) {
+      result.set(property.key.token.symbol, eval_expr(property.value.value()));
     }
 
-    // Restore the environment to its original state   
-    m_env.restore_scope(size);
+    return result;
   }
 
-  RuntimeVal eval_object_literal(ObjectLiteral object) {
-    for (Property property : object.properties) {
-      // If property has a value declare the variable in the environment
-      if (property.value.has_value()) {
-        VarDeclaration declaration = { property.key, property.value.value() };
-        m_env.declare_var(declaration);
-      } 
-      else { 
-        // If the property does not have a value make sure it has already been declared
-        m_env.search_var(property.key);
-      }
+  // Evaluate the value a function returns. A call there is in tail position, it is left for the
+  // enclosing eval_call_expr to run in place of the current call.
+  RuntimeVal eval_returned(const Expr& expr) {
+    auto call_expr = expr.get_if<CallExpr>();
+    if (!call_expr || m_call_depth == 0) {
+      return eval_expr(expr);
     }
-    
-    return NullLiteral();
+
+    if (m_trace) {
+      TraceStats::Timer timer(m_trace->exprs[expr.index()], m_trace->active_node);
+      return eval_call_expr(*call_expr, true);
+    }
+
+    return eval_call_expr(*call_expr, true);
   }
 
-  RuntimeVal eval_call_expr(CallExpr call_expr) {
-    std::vector<RuntimeVal> args;
-    for (Stmt arg : call_expr.args) {
-      args.emplace_back(evaluate(arg));
+  RuntimeVal eval_call_expr(const CallExpr& call_expr, bool tail = false) {
+    // Evaluate the arguments into the call arena, nested calls allocate after them and rewind
+    // before returning so the arguments stay in place
+    Arena::Mark mark = m_call_arena.mark();
+    size_t arg_count = call_expr.args.size();
+    RuntimeVal* args = m_call_arena.make_array<RuntimeVal>(arg_count);
+    for (size_t idx = 0; idx < arg_count; ++idx) {
+      args[idx] = evaluate(call_expr.args[idx]);
     }
 
     // Retrieve the function identifier from the caller expression
-    Identifier caller = call_expr.caller.get<Identifier>();
-    Expr expr = m_env.search_var(caller).expr.value();
+    const Identifier& caller = call_expr.caller.get<Identifier>();
+    const RuntimeVal& callee = m_env.search_var(caller);
 
     // Call the fucntion with the arguments and return the result
-    auto native_fn = expr.get_if<NativeFunction>();
+    auto native_fn = callee.get_if<NativeFunction>();
     if (native_fn) {
-      return native_fn->call(args);
+      RuntimeVal result = native_fn->call(std::span<const RuntimeVal>(args, arg_count));
+      m_call_arena.rewind(mark);
+      return result;
     }
 
-    auto function = expr.get_if<Function>();
+    auto function = callee.get_if<Function>();
     if (!function) {
-      m_error.report_error("Function `" + caller.token.raw_value.value() + 
+      m_error.report_error("Function `" + caller.token.text() +
           "` not declared in scope.", caller.token);
     }
 
-    std::shared_ptr<Environment> fn_env = (*function).env;
-    FunctionDeclaration function_dec = (*function).declaration;
+    const FunctionDeclaration& function_dec = *function->declaration;
 
-    if (args.size() != function_dec.params.size()) {
-      m_error.report_error("Number of arguments does not match function declaration.\n" 
-          "Expected " + std::to_string(function_dec.params.size()) + " arguments for function: " +
-          caller.token.raw_value.value(), caller.token);
+    // The argument count only needs checking when a new function is called from this site
+    if (call_expr.cache.declaration != &function_dec) {
+      if (arg_count != function_dec.params.size()) {
+        m_error.report_error("Number of arguments does not match function declaration.\n"
+            "Expected " + std::to_string(function_dec.params.size()) + " arguments for function: " +
+            caller.token.text(), caller.token);
+      }
+
+      call_expr.cache.declaration = &function_dec;
     }
 
-    // Create variables for the param list
-    for (int idx = 0; idx < args.size(); ++idx) {
-      if (fn_env->has_var(function_dec.params[idx]).has_value()) {
-        fn_env->assign_var(VarAssignment{ function_dec.params[idx], args[idx] });
-      } else {
-        fn_env->declare_var(VarDeclaration{ function_dec.params[idx], args[idx], false });
+    // A pure function called with the same arguments before returns the same result
+    std::span<const RuntimeVal> arg_values(args, arg_count);
+    bool memoized = m_memo && MemoCache::applies(function_dec, arg_values);
+    if (memoized) {
+      if (const RuntimeVal* cached = m_memo->find(&function_dec, arg_values)) {
+        m_call_arena.rewind(mark);
+        return *cached;
       }
     }
 
-    Interpreter interpreter(Program{ function_dec.body } , m_error, *fn_env);
-    RuntimeVal value = interpreter.evaluate_program();
-    return value;
-  }
+    // A tail call only records the callee and its arguments, the current body returns first
+    if (tail) {
+      m_tail_callee = callee;
+      m_tail_args.assign(std::make_move_iterator(args), std::make_move_iterator(args + arg_count));
+      m_call_arena.rewind(mark);
+      return NullLiteral();
+    }
 
-  RuntimeVal eval_member_expr(MemberExpr member_expr) {
-    Identifier object = member_expr.object;
-    Expr member = member_expr.member;
-
-    // Get the string representation of the identifier and search for it in the environment
-    Expr expr = m_env.search_var(object).expr.value();
-
-    // Loop while the expression is an ObjectLiteral
-    while (expr.is<ObjectLiteral>()) {
-      const std::vector<Property> properties = expr.get<ObjectLiteral>().properties;
-
-      // If the member is a nested MemberExpr, update the object and member
-      if (auto parent = member.get_if<MemberExpr>()) {
-        object = (*parent).object;
-        member = (*parent).member;
-      } 
-      // Otherwise, the member is an Identifier
-      else {
-        object = member.get<Identifier>();
-      }
+    if (m_call_depth >= m_max_call_depth) {
+      m_error.report_error("Stack overflow, more than " + std::to_string(m_max_call_depth) +
+          " nested calls when calling: " + caller.token.text(), caller.token);
+    }
+
+    // Calls made from deeply nested expressions use more native stack than budgeted for each
+    // call, so the stack left is checked too
+    char stack_position;
+    if (reinterpret_cast<uintptr_t>(&stack_position) < m_stack_limit) {
+      m_error.report_error("Stack overflow, out of stack after " + std::to_string(m_call_depth) +
+          " nested calls when calling: " + caller.token.text(), caller.token);
+    }
+
+    // Enter a frame for the call and fill in the param list. A memoized call keeps its arguments
+    // in the call arena to store its result under, nested calls allocate after them.
+    std::shared_ptr<Frame> caller_frame = m_env.push_frame(function->env, function_dec.slot_count);
+    for (size_t idx = 0; idx < arg_count; ++idx) {
+      m_env.declare_var(function_dec.params[idx], memoized ? args[idx] : std::move(args[idx]));
+    }
+    if (!memoized) {
+      m_call_arena.rewind(mark);
+    }
+
+    if (m_profiler) {
+      m_profile_stack.emplace_back(ProfileFrame{ function_dec.name.token.symbol, function_dec.name.token.line, nullptr });
+    }
+
+    ++m_call_depth;
+    RuntimeVal value = eval_function_body(function_dec.body);
 
-      // Find the property in the object literal with the matching key
-      std::string ident = object.token.raw_value.value();
-      auto it = std::find_if(properties.begin(), properties.end(), [&ident](const Property& property) {
-        return property.key.token.raw_value.value() == ident;
-      });
+    // Run the tail calls the body made in this frame, replacing its variables each time
+    while (m_tail_callee.has_value()) {
+      RuntimeVal next = std::move(m_tail_callee.value());
+      m_tail_callee.reset();
+      const Function& next_function = next.get<Function>();
+      const FunctionDeclaration& next_dec = *next_function.declaration;
 
-      // Check if the property is not found or has no value
-      if (it == properties.end()) {
-        m_error.report_error("Member: `" + ident + "` was not found in Object.", object.token);
+      m_env.pop_frame(std::move(caller_frame));
+      caller_frame = m_env.push_frame(next_function.env, next_dec.slot_count);
+      for (size_t idx = 0; idx < m_tail_args.size(); ++idx) {
+        m_env.declare_var(next_dec.params[idx], std::move(m_tail_args[idx]));
       }
 
-      if (it->value.has_value()) {
-        expr = it->value.value();
-      } else {
-        expr = m_env.search_var(it->key).expr.value();
+      if (m_profiler) {
+        m_profile_stack.back() = ProfileFrame{ next_dec.name.token.symbol, next_dec.name.token.line, nullptr };
       }
+
+      value = eval_function_body(next_dec.body);
+    }
+
+    --m_call_depth;
+    m_env.pop_frame(std::move(caller_frame));
+
+    if (memoized) {
+      m_memo->insert(&function_dec, arg_values, value);
+      m_call_arena.rewind(mark);
+    }
+
+    if (m_profiler) {
+      m_profile_stack.pop_back();
+    }
+
+    return value;
+  }
+
+  RuntimeVal eval_member_expr(const MemberExpr& member_expr) {
+    const RuntimeVal* value = &m_env.search_var(member_expr.object);
+    const MemberExpr* site = &member_expr;
+
+    // Walk the chain of members in place, each object is kept alive by the variable holding the root
+    while (auto parent = site->member.get_if<MemberExpr>()) {
+      value = &m_operators.get_member(*value, parent->object, site->cache);
+      site = parent;
     }
 
-    return eval_expr(expr);
+    return m_operators.get_member(*value, site->member.get<Identifier>(), site->cache);
   }
 
-  RuntimeVal eval_increment(Increment variable) {
-    IntLiteral one_literal{ Token{ TokenType::Int, 0, "1" } };
-    BinaryExpr increment{ variable.identifier, one_literal, variable.operand };
-    RuntimeVal incremented_val = eval_bin_expr(increment);
+  RuntimeVal eval_increment(const Increment& variable) {
+    IntLiteral one_literal{ Token{ TokenType::Int, 0 }, 1 };
+    RuntimeVal incremented_val = m_operators.eval_binary(m_env.search_var(variable.identifier),
+        one_literal, variable.operand);
 
-    VarAssignment assignment{ variable.identifier, incremented_val };
-    m_env.assign_var(assignment);
+    m_env.assign_var(variable.identifier, incremented_val);
 
     return incremented_val;
   }
 
-  bool eval_bool_expr(BoolExpr expr) {
-    TokenType operand = expr.operand.type;
-    auto lhs = eval_expr(expr.lhs).get_token().raw_value.value();
-    auto rhs = eval_expr(expr.rhs).get_token().raw_value.value();
-
-    switch (operand) {
-      case TokenType::Equals:
-        return lhs == rhs;
-      case TokenType::Not:
-        return lhs != rhs;
-      case TokenType::Greater:
-        return std::stoi(lhs) > std::stoi(rhs);
-      case TokenType::Less:
-        return std::stoi(lhs) < std::stoi(rhs);
-      case TokenType::GreaterEquals:
-        return std::stoi(lhs) >= std::stoi(rhs);
-      case TokenType::LessEquals:
-        return std::stoi(lhs) <= std::stoi(rhs);
-      case TokenType::And:
-        return eval_expr(expr.lhs).get<BoolLiteral>().value 
-            && eval_expr(expr.rhs).get<BoolLiteral>().value;
-      case TokenType::Or: 
-        return eval_expr(expr.lhs).get<BoolLiteral>().value 
-            || eval_expr(expr.rhs).get<BoolLiteral>().value;
-      default:
-        m_error.report_error("Unsupported operand in boolean expression.", expr.operand);
-    }
+  bool eval_bool_expr(const BoolExpr& expr) {
+    RuntimeVal lhs_temp;
+    RuntimeVal rhs_temp;
+    const RuntimeVal& lhs = eval_operand(expr.lhs, expr.rhs, lhs_temp);
+    const RuntimeVal& rhs = eval_operand(expr.rhs, expr.rhs, rhs_temp);
+    return m_operators.eval_boolean(lhs, rhs, expr.operand);
   }
 
-  RuntimeVal eval_bin_expr(BinaryExpr bin_expr) {
-    RuntimeVal lhs = evaluate(Stmt{ bin_expr.lhs });
-    RuntimeVal rhs = evaluate(Stmt{ bin_expr.rhs });
-    
-    // Evaluate NullLiteral
-    if (lhs.is<NullLiteral>()) {
-      return rhs;
-    }
-    if (rhs.is<NullLiteral>()) {
-      return lhs;
+  RuntimeVal eval_bin_expr(const BinaryExpr& bin_expr) {
+    RuntimeVal lhs_temp;
+    RuntimeVal rhs_temp;
+    const RuntimeVal& lhs = eval_operand(bin_expr.lhs, bin_expr.rhs, lhs_temp);
+    const RuntimeVal& rhs = eval_operand(bin_expr.rhs, bin_expr.rhs, rhs_temp);
+    return m_operators.eval_binary(lhs, rhs, bin_expr.operand);
+  }
+
+  // Evaluate an operand of a binary expression. Variables are read in place rather than copied
+  // unless evaluating the right hand side could change them first.
+  const RuntimeVal& eval_operand(const Expr& operand, const Expr& rhs, RuntimeVal& temp) {
+    bool rhs_is_pure = rhs.is<Identifier>() || rhs.is<IntLiteral>() || rhs.is<FloatLiteral>()
+      || rhs.is<StringLiteral>() || rhs.is<BoolLiteral>() || rhs.is<NullLiteral>();
+
+    auto identifier = operand.get_if<Identifier>();
+    if (identifier && rhs_is_pure) {
+      return m_env.search_var(*identifier);
     }
 
-    // Numeric Binary Expr
-    if ((lhs.is<IntLiteral>() || lhs.is<FloatLiteral>()) && 
-        (rhs.is<IntLiteral>() || rhs.is<FloatLiteral>())) {
+    temp = eval_expr(operand);
+    return temp;
+  }
 
-      auto lhs_num = get_numeric_value(lhs);
-      auto rhs_num = get_numeric_value(rhs);
-      auto num = eval_numeric_bin_expr(lhs_num, rhs_num, bin_expr.operand);
+  // Run body on a new thread with a stack for the deepest chain of calls allowed. The stack is
+  // only reserved, pages are backed by memory as calls reach them, with a guard page below.
+  template<typename F>
+  void run_with_stack(F& body) {
+    size_t stack_size = m_max_call_depth * stack_per_call + base_stack;
+    void* stack = mmap(nullptr, stack_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+      std::cerr << "Could not reserve a stack for " << m_max_call_depth << " nested calls, "
+                << "lower --max-call-depth\n";
+      std::exit(EXIT_FAILURE);
+    }
+
+    uintptr_t stack_start = reinterpret_cast<uintptr_t>(stack);
+    mprotect(stack, guard_size, PROT_NONE);
+    m_stack_limit = stack_start + guard_size + stack_reserve;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, static_cast<char*>(stack) + guard_size, stack_size - guard_size);
+
+    auto run = [](void* arg) -> void* {
+      (*static_cast<F*>(arg))();
+      return nullptr;
+    };
 
-      // Num result is an integer
-      if (num.index() == 0) {
-        Token result{ TokenType::Int, 0, std::to_string(std::get<int>(num)) };
-        return IntLiteral{ result };
-      }
-      // Num result is a double
-      else {
-        Token result{ TokenType::Float, 0, std::to_string(std::get<double>(num)) };
-        return FloatLiteral{ result };
-      }
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, run, &body) != 0) {
+      std::cerr << "Could not start the interpreter thread\n";
+      std::exit(EXIT_FAILURE);
     }
 
-    // Concatonate strings
-    auto lhs_str = lhs.get_if<StringLiteral>();
-    auto rhs_str = rhs.get_if<StringLiteral>(); 
+    pthread_join(thread, nullptr);
+    pthread_attr_destroy(&attr);
+    munmap(stack, stack_size);
+    m_stack_limit = 0;
+  }
 
-    if ( lhs_str && rhs_str && bin_expr.operand.type == TokenType::Plus) {
-      StringLiteral concat;
-      concat.token.raw_value = lhs_str->token.raw_value.value() + rhs_str->token.raw_value.value();
-      return concat;
+  // Lines are only worked out when a sample is taken, each frame reports its current statement
+  void sample() {
+    std::vector<Profiler::Frame> stack;
+    stack.reserve(m_profile_stack.size());
+    for (const ProfileFrame& frame : m_profile_stack) {
+      stack.emplace_back(Profiler::Frame{ frame.function, frame.stmt ? line_of(*frame.stmt) : frame.line });
     }
 
-    // Else Binary Expr is invalid
-    m_error.report_error("Expression:" + 
-        Error::to_string(lhs.get_token().type) +
-        Error::to_string(bin_expr.operand.type) +
-        Error::to_string(rhs.get_token().type) +
-        "is invalid.", bin_expr.operand);
-
-    return RuntimeVal();
+    m_profiler->record(stack);
   }
 
-  std::variant<int, double> get_numeric_value(const RuntimeVal val) {
-    return val.is<IntLiteral>() ? std::variant<int, double>(std::stoi(val.get_token().raw_value.value()))
-                                : std::variant<int, double>(std::stod(val.get_token().raw_value.value()));
+  static int line_of(const Stmt& stmt) {
+    return stmt.visit(overloaded {
+      [](const Expr& expr) { return line_of(expr); },
+      [](const VarDeclaration& declaration) { return declaration.identifier.token.line; },
+      [](const VarAssignment& assignment) { return assignment.identifier.token.line; },
+      [](const FunctionDeclaration& function_dec) { return function_dec.name.token.line; },
+      [](const ConditionalBlock& block) {
+        bool has_condition = !block.stmts.empty() && block.stmts.front().condition.has_value();
+        return has_condition ? block.stmts.front().condition->operand.line : 0;
+      },
+      [](const ForLoop& loop) { return loop.variable.identifier.token.line; },
+      [](const WhileLoop& loop) { return loop.condition.operand.line; }
+    });
   }
 
-  std::variant<int, double> eval_numeric_bin_expr(std::variant<int, double> lhs_num, 
-      std::variant<int, double> rhs_num, Token t_operand) {
-    TokenType operand = t_operand.type;
-
-    // Perform the arithmetic operation
-    auto perform_operation = [&](auto lhs, auto rhs) -> std::variant<int, double> {
-      switch (operand) {
-        case TokenType::Plus:
-          return { lhs + rhs };
-        case TokenType::Minus:
-          return { lhs - rhs };
-        case TokenType::Star:
-          return { lhs * rhs };
-        case TokenType::FwdSlash:
-          if (rhs != 0) // Check for division by zero
-            return { lhs / rhs };
-          else {
-            m_error.report_error("Division by zero.", t_operand);
-          }
-        case TokenType::Modulo:
-          if (rhs != 0) // Check for modulo by zero
-            return { static_cast<int>(lhs) % static_cast<int>(rhs) }; // Casting to int for modulo operation
-          else {
-            m_error.report_error("Modulo by zero.", t_operand);
-          }
-        default:
-          m_error.report_error("Invalid operand.", t_operand);
-      }
-    };
-
-    // Visit the variants and complete the arithmetic operation
-    return visit(perform_operation, lhs_num, rhs_num);
+  static int line_of(const Expr& expr) {
+    return expr.visit(overloaded {
+      [](const NullLiteral&) { return 0; },
+      [](const Identifier& ident) { return ident.token.line; },
+      [](const IntLiteral& literal) { return literal.token.line; },
+      [](const FloatLiteral& literal) { return literal.token.line; },
+      [](const StringLiteral& literal) { return literal.token.line; },
+      [](const BoolLiteral& literal) { return literal.token.line; },
+      [](const BinaryExpr& bin_expr) { return bin_expr.operand.line; },
+      [](const BoolExpr& bool_expr) { return bool_expr.operand.line; },
+      [](const ObjectLiteral& object) {
+        return object.properties.empty() ? 0 : object.properties.front().key.token.line;
+      },
+      [](const CallExpr& call_expr) { return line_of(call_expr.caller); },
+      [](const MemberExpr& member_expr) { return member_expr.object.token.line; },
+      [](const Increment& increment) { return increment.identifier.token.line; },
+      [](const ReturnExpr& return_expr) { return line_of(return_expr.expr); }
+    });
   }
 
 private:
+  // A call on the profiler's shadow stack, the line is used until the first statement runs
+  struct ProfileFrame {
+    Symbol function;
+    int line;
+    const Stmt* stmt;
+  };
+
   const Program m_program;
-  std::vector<VarDeclaration> vars;
-  Error m_error;
+  Error& m_error;
   Environment m_env;
+  Operators m_operators;
+  std::optional<RuntimeVal> m_return_value;
+  Arena m_call_arena;
+  Profiler* m_profiler = nullptr;
+  std::vector<ProfileFrame> m_profile_stack;
+  TraceStats* m_trace = nullptr;
+
+  // Native stack reserved for each nested call, and for everything else the program does
+  static constexpr size_t stack_per_call = 8 * 1024;
+  static constexpr size_t base_stack = 8 * 1024 * 1024;
+
+  // A call is refused once less than the reserve is left above the guard page, enough for a
+  // native function or to report the error
+  static constexpr size_t guard_size = 64 * 1024;
+  static constexpr size_t stack_reserve = 256 * 1024;
+  uintptr_t m_stack_limit = 0;
+
+  // Calls being evaluated, and a call made in tail position waiting for its caller to return
+  size_t m_call_depth = 0;
+  size_t m_max_call_depth = Environment::default_max_call_depth;
+  MemoCache* m_memo = nullptr;
+  std::optional<RuntimeVal> m_tail_callee;
+  std::vector<RuntimeVal> m_tail_args;
 };
-
@@ -1,35 +1,208 @@
-#include <fstream>
-#include <sstream>
-
+#include "allocations.hpp"
+#include "source.hpp"
 #include "tokenizer.hpp"
 #include "parser.hpp"
+#include "parallel_parser.hpp"
+#include "image.hpp"
+#include "resolver.hpp"
+#include "optimizer.hpp"
 #include "interpreter.hpp"
+#include "compiler.hpp"
+#include "vm.hpp"
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-      std::cerr << "No input file detected. Correct usage is...\n";  
-      std::cerr << "paint <input.wp>\n";  
+    // Parse command line flags, the tree walker is kept for differential testing against the VM
+    bool tree_walk = false;
+    bool debug_opt = false;
+    bool alloc_stats = false;
+    bool profile = false;
+    std::string profile_path = "paint.folded";
+    bool trace_stats = false;
+    bool trace_json = false;
+    size_t max_call_depth = Environment::default_max_call_depth;
+    bool memoize = true;
+    bool stream = false;
+    size_t parse_jobs = 1;
+    bool compile = false;
+    std::string path;
+
+    for (int idx = 1; idx < argc; ++idx) {
+      std::string arg = argv[idx];
+      if (arg == "--tree-walk") {
+        tree_walk = true;
+      } else if (arg == "--debug-opt") {
+        debug_opt = true;
+      } else if (arg == "--alloc-stats") {
+        alloc_stats = true;
+      } else if (arg == "--profile" || arg.starts_with("--profile=")) {
+        profile = true;
+        if (arg.size() > 10) {
+          profile_path = arg.substr(10);
+        }
+      } else if (arg == "--trace-stats" || arg == "--trace-stats=json") {
+        // Instrumentation is built into the tree walker
+        trace_stats = true;
+        trace_json = arg.ends_with("=json");
+        tree_walk = true;
+      } else if (arg == "--compile") {
+        compile = true;
+      } else if (arg == "--stream") {
+        // Statements run as they are read, which only the tree walker supports
+        stream = true;
+        tree_walk = true;
+      } else if (arg == "--no-memo") {
+        memoize = false;
+      } else if (arg == "--parse-jobs" && idx + 1 < argc) {
+        // Zero uses every core
+        int jobs = std::max(0, std::atoi(argv[++idx]));
+        parse_jobs = jobs > 0 ? jobs : std::max(1u, std::thread::hardware_concurrency());
+      } else if (arg == "--max-call-depth" && idx + 1 < argc) {
+        max_call_depth = std::max(1, std::atoi(argv[++idx]));
+      } else {
+        path = arg;
+      }
+    }
+
+    // Standard input is always streamed
+    if (path == "-") {
+      stream = true;
+      tree_walk = true;
+    }
+
+    if (path.empty()) {
+      std::cerr << "No input file detected. Correct usage is...\n";
+      std::cerr << "paint [--tree-walk] [--debug-opt] [--alloc-stats] [--profile[=stacks.folded]] [--trace-stats[=json]] [--max-call-depth N] [--no-memo] [--stream] [--parse-jobs N] [--compile] <input.wp | ->\n";
+      return EXIT_FAILURE;
+    }
+
+    if (compile && stream) {
+      std::cerr << "Only whole files can be compiled, not streamed input.\n";
       return EXIT_FAILURE;
     }
-    
-    // Read file into contents
-    std::string contents;
-    std::stringstream contents_stream;
-    std::fstream input(argv[1], std::ios::in);
-    contents_stream << input.rdbuf();
-    contents = contents_stream.str();
-    
-    Tokenizer tokenizer(contents);
-    std::vector<Token> tokens = tokenizer.tokenize();
 
-    Error error(tokens);
+    size_t setup_allocations = 0;
+    std::optional<Profiler> profiler;
+    TraceStats trace;
+    MemoCache memo;
+
+    auto configure = [&](Interpreter& interpreter) {
+      interpreter.set_max_call_depth(max_call_depth);
+      if (memoize) {
+        interpreter.set_memo(&memo);
+      }
+      if (profile) {
+        interpreter.set_profiler(&profiler.emplace());
+      }
+      if (trace_stats) {
+        interpreter.set_trace(&trace);
+      }
+    };
+
+    auto report = [&]() {
+      if (profiler.has_value()) {
+        profiler->report(std::cerr, profile_path);
+      }
+
+      trace.memo_hits = memo.hits();
+      trace.memo_misses = memo.misses();
+      trace.memo_evictions = memo.evictions();
 
-    Parser parser(tokens, error);
-    Program program = parser.create_ast();    
+      if (trace_json) {
+        trace.report_json(std::cerr);
+      } else if (trace_stats) {
+        trace.report_table(std::cerr);
+      }
+
+      // Execution allocations should not grow with the number of loop iterations
+      if (alloc_stats) {
+        std::cerr << "memo: " << memo.hits() << " hits, " << memo.misses() << " misses, "
+                  << memo.evictions() << " evicted, " << memo.disabled() << " functions no longer memoized\n";
+        std::cerr << "allocations: " << allocations::count << " (" << allocations::bytes << " bytes), "
+                  << allocations::count - setup_allocations << " during execution\n";
+      }
+    };
+
+    // Run each statement as soon as it is read, keeping only a window of the source, which the
+    // stream points the error reporter at as it reads
+    if (stream) {
+      Error error("");
+      StatementStream statements(path, error, debug_opt);
+      Interpreter interpreter(statements.program(), error, Environment(error));
+      configure(interpreter);
+
+      setup_allocations = allocations::count;
+      interpreter.evaluate_stream(statements);
+      report();
+      return EXIT_SUCCESS;
+    }
 
-    Environment env(error);
-    Interpreter interpreter(program, error, env);
-    RuntimeVal runtimeVal = interpreter.evaluate_program();
+    // Map the file, tokens and values refer into it for the rest of the run
+    Source source(path);
+
+    // The source and error reporter are shared by reference with every stage
+    Error error(source.text());
+
+    // An image compiled from this exact source replaces tokenizing, parsing, resolving and
+    // optimizing. Its text is viewed in place, so it stays mapped for the rest of the run.
+    std::string image_path = Image::path_for(path);
+    std::optional<Source> image;
+    std::optional<Program> loaded;
+    if (!compile && !debug_opt && access(image_path.c_str(), R_OK) == 0) {
+      image.emplace(image_path);
+      loaded = Image::load(image->text(), source.text());
+    }
+
+    Program program;
+    if (loaded.has_value()) {
+      program = std::move(loaded.value());
+    } else {
+      // Tokens are only needed until the tree is built
+      if (parse_jobs > 1) {
+        ParallelParser parser(source.text(), error, parse_jobs);
+        program = parser.create_ast();
+      } else {
+        Tokenizer tokenizer(source.text(), error);
+        std::vector<Token> tokens = tokenizer.tokenize();
+
+        Parser parser(tokens, error);
+        program = parser.create_ast();
+      }
+
+      Resolver resolver(error);
+      program = resolver.resolve(program);
+
+      Optimizer optimizer(error, debug_opt);
+      program = optimizer.optimize(program);
+    }
+
+    if (compile) {
+      Image::save(image_path, program, source.text());
+      return EXIT_SUCCESS;
+    }
+
+    Environment env(error, program.slot_count);
+
+    if (tree_walk) {
+      Interpreter interpreter(std::move(program), error, std::move(env));
+      configure(interpreter);
+
+      setup_allocations = allocations::count;
+      interpreter.evaluate_program();
+    } else {
+      Compiler compiler(error);
+      VM vm(compiler.compile(program), error, std::move(env));
+      vm.set_max_call_depth(max_call_depth);
+      if (memoize) {
+        vm.set_memo(&memo);
+      }
+      if (profile) {
+        vm.set_profiler(&profiler.emplace());
+      }
+
+      setup_allocations = allocations::count;
+      vm.run();
+    }
 
+    report();
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,274 @@
+// The AST includes this header for MemoStats alone, as every function declaration holds one,
+// while the cache below needs the AST. Each part has its own guard so either can come first.
+#ifndef MEMO_STATS
+#define MEMO_STATS
+
+#include <cstdint>
+
+// Per-function record of how often calls to a pure function were answered from the memo cache.
+// Functions whose calls rarely repeat are no longer looked up or stored.
+struct MemoStats {
+  uint32_t lookups = 0;
+  uint32_t hits = 0;
+  bool disabled = false;
+};
+
+#endif
+
+#if !defined(MEMO_STATS_ONLY) && !defined(MEMO_CACHE)
+#define MEMO_CACHE
+
+#include "values/ast.hpp"
+
+#include <array>
+#include <bit>
+#include <vector>
+
+// Bounded least recently used cache of the results of pure functions, keyed on the function and
+// its argument values. Only calls whose arguments and result are all literal values are cached,
+// objects and functions are compared by identity and could change meaning between calls.
+//
+// Entries live in a fixed pool allocated by the first store, holding their arguments inline and
+// linked by index into hash chains and the recency list, so lookups and stores never allocate.
+class MemoCache {
+public:
+  static constexpr size_t default_capacity = 4096;
+
+  // Calls with more arguments than an entry holds are not cached
+  static constexpr size_t max_args = 4;
+
+  // Each function is judged over a window of lookups, and stops being memoized if fewer than one
+  // in eight of them were hits, as its misses cost a store into the cache for nothing
+  static constexpr uint32_t window = 1024;
+  static constexpr uint32_t min_hits = window / 8;
+
+  explicit MemoCache(size_t capacity = default_capacity)
+    : m_capacity(std::max<size_t>(capacity, 1))
+  {
+  }
+
+  static bool cacheable(std::span<const RuntimeVal> values) {
+    for (const RuntimeVal& value : values) {
+      if (value.is<Object>() || value.is<Function>() || value.is<NativeFunction>()) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // Whether a call to function with args is looked up in the cache and its result stored
+  static bool applies(const FunctionDeclaration& function, std::span<const RuntimeVal> args) {
+    return function.pure && !function.memo.disabled && args.size() <= max_args && cacheable(args);
+  }
+
+  // The cached result of calling function with args, marking it as the most recently used
+  const RuntimeVal* find(const FunctionDeclaration* function, std::span<const RuntimeVal> args) {
+    if (!m_buckets.empty()) {
+      size_t key = hash(function, args);
+      for (uint32_t idx = m_buckets[key & (m_buckets.size() - 1)]; idx != none; idx = m_entries[idx].chain) {
+        Entry& entry = m_entries[idx];
+        if (entry.hash == key && entry.function == function && same_values(entry.arguments(), args)) {
+          unlink(idx);
+          link_newest(idx);
+          ++m_hits;
+          record(*function, true);
+          return &entry.result;
+        }
+      }
+    }
+
+    ++m_misses;
+    record(*function, false);
+    return nullptr;
+  }
+
+  void insert(const FunctionDeclaration* function, std::span<const RuntimeVal> args, const RuntimeVal& result) {
+    if (!cacheable(std::span<const RuntimeVal>(&result, 1))) {
+      return;
+    }
+
+    if (m_entries.empty()) {
+      m_entries.resize(m_capacity);
+      m_buckets.assign(std::bit_ceil(m_capacity), none);
+    }
+
+    // Take an unused entry, or the least recently used one once the pool is full
+    uint32_t idx;
+    if (m_used < m_capacity) {
+      idx = m_used++;
+    } else {
+      idx = m_oldest;
+      unlink(idx);
+      unchain(idx);
+      ++m_evictions;
+    }
+
+    Entry& entry = m_entries[idx];
+    entry.function = function;
+    entry.hash = hash(function, args);
+    entry.arg_count = args.size();
+    std::copy(args.begin(), args.end(), entry.args.begin());
+    entry.result = result;
+
+    uint32_t& bucket = m_buckets[entry.hash & (m_buckets.size() - 1)];
+    entry.chain = bucket;
+    bucket = idx;
+    link_newest(idx);
+  }
+
+  size_t hits() const {
+    return m_hits;
+  }
+
+  size_t misses() const {
+    return m_misses;
+  }
+
+  size_t evictions() const {
+    return m_evictions;
+  }
+
+  // Functions no longer memoized because their calls rarely repeated
+  size_t disabled() const {
+    return m_disabled;
+  }
+
+private:
+  static constexpr uint32_t none = UINT32_MAX;
+
+  struct Entry {
+    const FunctionDeclaration* function = nullptr;
+    std::array<RuntimeVal, max_args> args;
+    size_t arg_count = 0;
+    RuntimeVal result;
+    size_t hash = 0;
+    // Next entry in the same bucket, and the neighbours in order of use
+    uint32_t chain = none;
+    uint32_t newer = none;
+    uint32_t older = none;
+
+    std::span<const RuntimeVal> arguments() const {
+      return std::span<const RuntimeVal>(args.data(), arg_count);
+    }
+  };
+
+  void record(const FunctionDeclaration& function, bool hit) {
+    MemoStats& stats = function.memo;
+    stats.hits += hit;
+    if (++stats.lookups < window) {
+      return;
+    }
+
+    if (stats.hits < min_hits) {
+      stats.disabled = true;
+      ++m_disabled;
+    }
+
+    stats.lookups = 0;
+    stats.hits = 0;
+  }
+
+  void link_newest(uint32_t idx) {
+    Entry& entry = m_entries[idx];
+    entry.newer = none;
+    entry.older = m_newest;
+    if (m_newest != none) {
+      m_entries[m_newest].newer = idx;
+    }
+
+    m_newest = idx;
+    if (m_oldest == none) {
+      m_oldest = idx;
+    }
+  }
+
+  void unlink(uint32_t idx) {
+    Entry& entry = m_entries[idx];
+    (entry.newer != none ? m_entries[entry.newer].older : m_newest) = entry.older;
+    (entry.older != none ? m_entries[entry.older].newer : m_oldest) = entry.newer;
+  }
+
+  // Remove an entry from its bucket's chain
+  void unchain(uint32_t idx) {
+    uint32_t* link = &m_buckets[m_entries[idx].hash & (m_buckets.size() - 1)];
+    while (*link != idx) {
+      link = &m_entries[*link].chain;
+    }
+
+    *link = m_entries[idx].chain;
+  }
+
+  static size_t hash(const FunctionDeclaration* function, std::span<const RuntimeVal> args) {
+    size_t seed = std::hash<const void*>()(function);
+    for (const RuntimeVal& arg : args) {
+      seed ^= hash_value(arg) + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2);
+    }
+
+    return seed;
+  }
+
+  static size_t hash_value(const RuntimeVal& value) {
+    return value.index() ^ value.visit(overloaded {
+      [](const IntLiteral& literal) { return std::hash<int64_t>()(literal.value); },
+      [](const FloatLiteral& literal) { return std::hash<double>()(literal.value); },
+      [](const StringLiteral& literal) { return std::hash<std::string_view>()(literal.token.raw_value.value_or("")); },
+      [](const BoolLiteral& literal) { return std::hash<bool>()(literal.value); },
+      [](const auto&) { return size_t{ 0 }; }
+    });
+  }
+
+  // Numbers written differently in the source print differently, so their text must match too
+  static bool same_values(std::span<const RuntimeVal> lhs, std::span<const RuntimeVal> rhs) {
+    if (lhs.size() != rhs.size()) {
+      return false;
+    }
+
+    for (size_t idx = 0; idx < lhs.size(); ++idx) {
+      if (lhs[idx].index() != rhs[idx].index()) {
+        return false;
+      }
+
+      bool same = lhs[idx].visit(overloaded {
+        [&](const IntLiteral& literal) {
+          const IntLiteral& other = rhs[idx].get<IntLiteral>();
+          return literal.value == other.value && literal.token.raw_value == other.token.raw_value;
+        },
+        [&](const FloatLiteral& literal) {
+          const FloatLiteral& other = rhs[idx].get<FloatLiteral>();
+          return literal.value == other.value && literal.token.raw_value == other.token.raw_value &&
+              literal.decimals == other.decimals;
+        },
+        [&](const StringLiteral& literal) {
+          return literal.token.raw_value.value_or("") == rhs[idx].get<StringLiteral>().token.raw_value.value_or("");
+        },
+        [&](const BoolLiteral& literal) {
+          return literal.value == rhs[idx].get<BoolLiteral>().value;
+        },
+        [](const auto&) {
+          return true;
+        }
+      });
+
+      if (!same) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+private:
+  size_t m_capacity;
+  std::vector<Entry> m_entries;
+  std::vector<uint32_t> m_buckets;
+  size_t m_used = 0;
+  uint32_t m_newest = none;
+  uint32_t m_oldest = none;
+  size_t m_hits = 0;
+  size_t m_misses = 0;
+  size_t m_evictions = 0;
+  size_t m_disabled = 0;
+};
+
+#endif
@@ -0,0 +1,241 @@
+#pragma once
+
+#include "error.hpp"
+#include "values/ast.hpp"
+#include "values/inline_cache.hpp"
+
+#include <variant>
+
+// Arithmetic, comparison and member access rules shared by the tree walker and the VM
+class Operators {
+public:
+  explicit Operators(Error& error)
+    : m_error(error)
+  {
+  }
+
+  RuntimeVal eval_binary(const RuntimeVal& lhs, const RuntimeVal& rhs, const Token& operand) {
+    // Evaluate NullLiteral
+    if (lhs.is<NullLiteral>()) {
+      return rhs;
+    }
+    if (rhs.is<NullLiteral>()) {
+      return lhs;
+    }
+
+    // Numeric Binary Expr
+    if (is_numeric(lhs) && is_numeric(rhs)) {
+      auto num = eval_numeric(get_numeric_value(lhs), get_numeric_value(rhs), operand);
+
+      // Num result is an integer
+      if (num.index() == 0) {
+        return IntLiteral{ Token{ TokenType::Int, 0 }, std::get<int64_t>(num) };
+      }
+      // Num result is a double
+      else {
+        return FloatLiteral{ Token{ TokenType::Float, 0 }, std::get<double>(num) };
+      }
+    }
+
+    // Concatonate strings
+    auto lhs_str = lhs.get_if<StringLiteral>();
+    auto rhs_str = rhs.get_if<StringLiteral>();
+
+    if (lhs_str && rhs_str && operand.type == TokenType::Plus) {
+      StringLiteral concat{ Token{ TokenType::String, 0 } };
+      concat.owned = std::make_shared<const std::string>(lhs_str->token.text() + rhs_str->token.text());
+      concat.token.raw_value = *concat.owned;
+      return concat;
+    }
+
+    // Else Binary Expr is invalid
+    m_error.report_error("Expression:" +
+        Error::to_string(lhs.get_token().type) +
+        Error::to_string(operand.type) +
+        Error::to_string(rhs.get_token().type) +
+        "is invalid.", operand);
+  }
+
+  bool eval_boolean(const RuntimeVal& lhs, const RuntimeVal& rhs, const Token& operand) {
+    // Logical operators require boolean operands
+    if (operand.type == TokenType::And || operand.type == TokenType::Or) {
+      auto lhs_bool = lhs.get_if<BoolLiteral>();
+      auto rhs_bool = rhs.get_if<BoolLiteral>();
+
+      if (!lhs_bool || !rhs_bool) {
+        m_error.report_error("Logical operands must be booleans.", operand);
+      }
+
+      return operand.type == TokenType::And
+        ? lhs_bool->value && rhs_bool->value
+        : lhs_bool->value || rhs_bool->value;
+    }
+
+    // Numeric comparison operates directly on the unboxed values
+    if (is_numeric(lhs) && is_numeric(rhs)) {
+      auto compare = [&](auto lhs_num, auto rhs_num) -> bool {
+        switch (operand.type) {
+          case TokenType::Equals:
+            return lhs_num == rhs_num;
+          case TokenType::Not:
+            return lhs_num != rhs_num;
+          case TokenType::Greater:
+            return lhs_num > rhs_num;
+          case TokenType::Less:
+            return lhs_num < rhs_num;
+          case TokenType::GreaterEquals:
+            return lhs_num >= rhs_num;
+          case TokenType::LessEquals:
+            return lhs_num <= rhs_num;
+          default:
+            m_error.report_error("Unsupported operand in boolean expression.", operand);
+        }
+      };
+
+      return std::visit(compare, get_numeric_value(lhs), get_numeric_value(rhs));
+    }
+
+    // Interned strings are equal exactly when their symbols are, strings built at runtime have no symbol
+    auto lhs_str = lhs.get_if<StringLiteral>();
+    auto rhs_str = rhs.get_if<StringLiteral>();
+    if (lhs_str && rhs_str && lhs_str->token.symbol != SymbolTable::empty && rhs_str->token.symbol != SymbolTable::empty
+        && (operand.type == TokenType::Equals || operand.type == TokenType::Not)) {
+      return (lhs_str->token.symbol == rhs_str->token.symbol) == (operand.type == TokenType::Equals);
+    }
+
+    switch (operand.type) {
+      case TokenType::Equals:
+        return lhs.to_string() == rhs.to_string();
+      case TokenType::Not:
+        return lhs.to_string() != rhs.to_string();
+      case TokenType::Greater:
+      case TokenType::Less:
+      case TokenType::GreaterEquals:
+      case TokenType::LessEquals:
+        m_error.report_error("Comparison operands must be numeric.", operand);
+      default:
+        m_error.report_error("Unsupported operand in boolean expression.", operand);
+    }
+  }
+
+  // Look up a member through the inline cache of the site accessing it
+  const RuntimeVal& get_member(const RuntimeVal& value, const Identifier& key, PropertyCache& cache) {
+    auto object = value.get_if<Object>();
+    if (!object) {
+      m_error.report_error("Member: `" + key.token.text() +
+          "` accessed on a value that is not an Object.", key.token);
+    }
+
+    // Find the property in the object with the matching key
+    uint32_t slot = cache.lookup(object->shape, key.token.symbol);
+    if (slot == Shape::not_found) {
+      m_error.report_error("Member: `" + key.token.text() + "` was not found in Object.", key.token);
+    }
+
+    return object->values[slot];
+  }
+
+  // A for loop that steps an integer counter by one towards a literal bound,
+  // `for (i = a, i < b, i++)`, which both engines run without the generic operators
+  struct CountedLoop {
+    int64_t bound;
+    Token compare;
+    int64_t step;
+  };
+
+  static std::optional<CountedLoop> counted_loop(const ForLoop& loop) {
+    const Identifier& counter = loop.variable.identifier;
+    auto same_variable = [&counter](const Identifier& identifier) {
+      return identifier.depth == counter.depth && identifier.slot == counter.slot;
+    };
+
+    auto lhs = loop.condition.lhs.get_if<Identifier>();
+    auto bound = loop.condition.rhs.get_if<IntLiteral>();
+    auto increment = loop.counter.get_if<Increment>();
+    if (!lhs || !bound || !increment || !same_variable(*lhs) || !same_variable(increment->identifier)) {
+      return {};
+    }
+
+    switch (loop.condition.operand.type) {
+      case TokenType::Less:
+      case TokenType::LessEquals:
+      case TokenType::Greater:
+      case TokenType::GreaterEquals:
+      case TokenType::Not:
+        break;
+      default:
+        return {};
+    }
+
+    int64_t step = increment->operand.type == TokenType::Plus ? 1 : -1;
+    return CountedLoop{ bound->value, loop.condition.operand, step };
+  }
+
+  static bool compare_int(int64_t lhs, int64_t rhs, TokenType compare) {
+    switch (compare) {
+      case TokenType::Less:
+        return lhs < rhs;
+      case TokenType::LessEquals:
+        return lhs <= rhs;
+      case TokenType::Greater:
+        return lhs > rhs;
+      case TokenType::GreaterEquals:
+        return lhs >= rhs;
+      default:
+        return lhs != rhs;
+    }
+  }
+
+  static BoolLiteral make_bool(bool boolean) {
+    Token token = boolean ? Token{ TokenType::True, 0, "true" }
+                          : Token{ TokenType::False, 0, "false" };
+    return BoolLiteral{ boolean, token };
+  }
+
+private:
+  static bool is_numeric(const RuntimeVal& val) {
+    return val.is<IntLiteral>() || val.is<FloatLiteral>();
+  }
+
+  static std::variant<int64_t, double> get_numeric_value(const RuntimeVal& val) {
+    return val.is<IntLiteral>() ? std::variant<int64_t, double>(val.get<IntLiteral>().value)
+                                : std::variant<int64_t, double>(val.get<FloatLiteral>().value);
+  }
+
+  std::variant<int64_t, double> eval_numeric(std::variant<int64_t, double> lhs_num,
+      std::variant<int64_t, double> rhs_num, const Token& t_operand) {
+    TokenType operand = t_operand.type;
+
+    // Perform the arithmetic operation
+    auto perform_operation = [&](auto lhs, auto rhs) -> std::variant<int64_t, double> {
+      switch (operand) {
+        case TokenType::Plus:
+          return { lhs + rhs };
+        case TokenType::Minus:
+          return { lhs - rhs };
+        case TokenType::Star:
+          return { lhs * rhs };
+        case TokenType::FwdSlash:
+          if (rhs != 0) // Check for division by zero
+            return { lhs / rhs };
+          else {
+            m_error.report_error("Division by zero.", t_operand);
+          }
+        case TokenType::Modulo:
+          if (rhs != 0) // Check for modulo by zero
+            return { static_cast<int64_t>(lhs) % static_cast<int64_t>(rhs) }; // Casting to int for modulo operation
+          else {
+            m_error.report_error("Modulo by zero.", t_operand);
+          }
+        default:
+          m_error.report_error("Invalid operand.", t_operand);
+      }
+    };
+
+    // Visit the variants and complete the arithmetic operation
+    return std::visit(perform_operation, lhs_num, rhs_num);
+  }
+
+private:
+  Error& m_error;
+};
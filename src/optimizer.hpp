@@ -0,0 +1,474 @@
+#pragma once
+
+#include "operators.hpp"
+
+// Folds constant expressions, propagates const declarations with literal values, removes
+// conditional branches that can never run and marks pure functions. Runs on a resolved Program
+// before execution.
+class Optimizer {
+public:
+  explicit Optimizer(Error& error, bool debug = false)
+    : m_operators(error), m_debug(debug)
+  {
+  }
+
+  Program optimize(const Program& program) {
+    Program optimized;
+    optimized.slot_count = program.slot_count;
+    optimized.arena = program.arena;
+    Arena::Scope scope(*optimized.arena);
+
+    begin_program(*program.arena);
+    optimized.stmts = optimize_body(program.stmts);
+    end_program();
+
+    return optimized;
+  }
+
+  // Start a program whose top level statements are optimized one at a time by optimize_next.
+  // Function declarations are built in the given arena, everything else in the current one.
+  void begin_program(Arena& functions) {
+    m_arena = &functions;
+    m_functions.emplace_back();
+  }
+
+  // Returns nothing when the statement can never have an effect
+  std::optional<Stmt> optimize_next(const Stmt& stmt) {
+    return optimize_stmt(stmt);
+  }
+
+  void end_program() {
+    m_functions.pop_back();
+
+    if (m_debug) {
+      std::cerr << "Optimizer: folded " << m_folded << " expressions, propagated " << m_propagated
+                << " constants, removed " << m_removed << " dead branches, found " << m_pure
+                << " pure functions\n";
+    }
+  }
+
+private:
+  // Known literal values of const variables, indexed by slot, for one function
+  using Constants = std::vector<std::optional<Expr>>;
+
+  std::vector<Stmt> optimize_body(const std::vector<Stmt>& body) {
+    std::vector<Stmt> optimized;
+    for (size_t idx = 0; idx < body.size(); ++idx) {
+      std::optional<Stmt> stmt = optimize_stmt(body[idx]);
+      if (stmt.has_value()) {
+        optimized.emplace_back(std::move(stmt.value()));
+      }
+      // The value of a trailing expression is returned, so a removed last statement is kept as
+      // an empty block rather than exposing the statement before it
+      else if (idx + 1 == body.size()) {
+        optimized.emplace_back(ConditionalBlock{});
+      }
+    }
+
+    return optimized;
+  }
+
+  // Returns nothing when the statement can never have an effect
+  std::optional<Stmt> optimize_stmt(const Stmt& stmt) {
+    return stmt.visit(overloaded {
+      [this](const Expr& expr) -> std::optional<Stmt> {
+        return Stmt{ optimize_expr(expr) };
+      },
+      [this](const VarDeclaration& declaration) -> std::optional<Stmt> {
+        VarDeclaration optimized = declaration;
+        if (declaration.expr.has_value()) {
+          optimized.expr = optimize_expr(declaration.expr.value());
+        }
+
+        // Remember the value of constants declared with a literal
+        bool literal = optimized.expr.has_value() && is_literal(optimized.expr.value());
+        set_constant(optimized.identifier,
+            declaration.constant && literal ? optimized.expr : std::nullopt);
+        return optimized;
+      },
+      [this](const VarAssignment& assignment) -> std::optional<Stmt> {
+        set_constant(assignment.identifier, std::nullopt);
+        return VarAssignment{ assignment.identifier, optimize_expr(assignment.expr) };
+      },
+      [this](const FunctionDeclaration& function_dec) -> std::optional<Stmt> {
+        Arena::Scope scope(*m_arena);
+        FunctionDeclaration optimized = function_dec;
+        set_constant(function_dec.name, std::nullopt);
+
+        m_functions.emplace_back();
+        optimized.body = optimize_body(function_dec.body);
+        m_functions.pop_back();
+
+        optimized.pure = is_pure(optimized);
+        if (optimized.pure) {
+          report("function `" + function_dec.name.token.text() + "` is pure, its results are memoized",
+              function_dec.name.token);
+          ++m_pure;
+        }
+
+        return optimized;
+      },
+      [this](const ConditionalBlock& block) -> std::optional<Stmt> {
+        return optimize_conditional(block);
+      },
+      [this](const ForLoop& loop) -> std::optional<Stmt> {
+        ForLoop optimized = loop;
+        set_constant(loop.variable.identifier, std::nullopt);
+
+        optimized.variable.expr = optimize_expr(loop.variable.expr);
+        optimized.condition = optimize_bool_expr(loop.condition);
+        optimized.counter = optimize_expr(loop.counter);
+        optimized.body = optimize_body(loop.body);
+        return optimized;
+      },
+      [this](const WhileLoop& loop) -> std::optional<Stmt> {
+        BoolExpr condition = optimize_bool_expr(loop.condition);
+        if (constant_condition(condition) == false) {
+          report("removed while loop that never runs", condition.operand);
+          ++m_removed;
+          return std::nullopt;
+        }
+
+        return WhileLoop{ condition, optimize_body(loop.body) };
+      }
+    });
+  }
+
+  // Drop branches whose condition is always false and turn the first always true branch into
+  // the final else
+  std::optional<Stmt> optimize_conditional(const ConditionalBlock& block) {
+    ConditionalBlock optimized;
+
+    for (const ConditionalStmt& stmt : block.stmts) {
+      ConditionalStmt conditional{ stmt.type };
+
+      if (stmt.condition.has_value()) {
+        BoolExpr condition = optimize_bool_expr(stmt.condition.value());
+        std::optional<bool> known = constant_condition(condition);
+
+        if (known == false) {
+          report("removed branch that never runs", condition.operand);
+          ++m_removed;
+          continue;
+        }
+
+        if (known != true) {
+          conditional.condition = condition;
+        } else {
+          conditional.type = TokenType::Else;
+        }
+      }
+
+      conditional.body = optimize_body(stmt.body);
+      optimized.stmts.emplace_back(std::move(conditional));
+
+      if (!optimized.stmts.back().condition.has_value()) {
+        break;
+      }
+    }
+
+    if (optimized.stmts.empty()) {
+      return std::nullopt;
+    }
+
+    return optimized;
+  }
+
+  Expr optimize_expr(const Expr& expr) {
+    return expr.visit(overloaded {
+      [this](const Identifier& ident) -> Expr {
+        const std::optional<Expr>& constant = find_constant(ident);
+        if (!constant.has_value()) {
+          return ident;
+        }
+
+        report("propagated constant `" + ident.token.text() + "`", ident.token);
+        ++m_propagated;
+        return constant.value();
+      },
+      [this](const BinaryExpr& bin_expr) -> Expr {
+        BinaryExpr optimized{ optimize_expr(bin_expr.lhs), optimize_expr(bin_expr.rhs), bin_expr.operand };
+
+        std::optional<Expr> folded = fold_binary(optimized);
+        if (!folded.has_value()) {
+          return optimized;
+        }
+
+        report("folded constant expression", bin_expr.operand);
+        ++m_folded;
+        return folded.value();
+      },
+      [this](const BoolExpr& bool_expr) -> Expr {
+        BoolExpr optimized = optimize_bool_expr(bool_expr);
+
+        std::optional<bool> known = constant_condition(optimized);
+        if (!known.has_value()) {
+          return optimized;
+        }
+
+        report("folded constant condition", bool_expr.operand);
+        ++m_folded;
+        BoolLiteral literal = Operators::make_bool(known.value());
+        literal.token.line = bool_expr.operand.line;
+        return literal;
+      },
+      [this](const ObjectLiteral& object) -> Expr {
+        ObjectLiteral optimized;
+        for (const Property& property : object.properties) {
+          std::optional<Expr> value;
+          if (property.value.has_value()) {
+            value = optimize_expr(property.value.value());
+          }
+
+          optimized.properties.emplace_back(Property{ property.key, value });
+        }
+
+        return optimized;
+      },
+      [this](const CallExpr& call_expr) -> Expr {
+        CallExpr optimized{ {}, call_expr.caller };
+        for (const Stmt& arg : call_expr.args) {
+          std::optional<Stmt> value = optimize_stmt(arg);
+          optimized.args.emplace_back(value.has_value() ? value.value() : Stmt{ Expr{ NullLiteral() } });
+        }
+
+        return optimized;
+      },
+      [this](const Increment& increment) -> Expr {
+        set_constant(increment.identifier, std::nullopt);
+        return increment;
+      },
+      [this](const ReturnExpr& return_expr) -> Expr {
+        return ReturnExpr{ optimize_expr(return_expr.expr) };
+      },
+      // Literals and member accesses are left as they are
+      [](const auto& node) -> Expr {
+        return node;
+      }
+    });
+  }
+
+  BoolExpr optimize_bool_expr(const BoolExpr& bool_expr) {
+    return BoolExpr{ optimize_expr(bool_expr.lhs), optimize_expr(bool_expr.rhs), bool_expr.operand };
+  }
+
+  // Evaluate a binary expression of two literals, unless it would report an error at runtime
+  std::optional<Expr> fold_binary(const BinaryExpr& bin_expr) {
+    if (!is_literal(bin_expr.lhs) || !is_literal(bin_expr.rhs)) {
+      return {};
+    }
+
+    RuntimeVal lhs = to_value(bin_expr.lhs);
+    RuntimeVal rhs = to_value(bin_expr.rhs);
+    TokenType operand = bin_expr.operand.type;
+
+    bool numeric = is_numeric(lhs) && is_numeric(rhs);
+    bool divides = operand == TokenType::FwdSlash || operand == TokenType::Modulo;
+    bool foldable = lhs.is<NullLiteral>() || rhs.is<NullLiteral>()
+      || (numeric && !(divides && is_zero(rhs)))
+      || (lhs.is<StringLiteral>() && rhs.is<StringLiteral>() && operand == TokenType::Plus);
+
+    if (!foldable) {
+      return {};
+    }
+
+    return to_literal(m_operators.eval_binary(lhs, rhs, bin_expr.operand), bin_expr.operand.line);
+  }
+
+  // The value of a condition of two literals, unless it would report an error at runtime
+  std::optional<bool> constant_condition(const BoolExpr& bool_expr) {
+    if (!is_literal(bool_expr.lhs) || !is_literal(bool_expr.rhs)) {
+      return {};
+    }
+
+    RuntimeVal lhs = to_value(bool_expr.lhs);
+    RuntimeVal rhs = to_value(bool_expr.rhs);
+
+    switch (bool_expr.operand.type) {
+      case TokenType::Equals:
+      case TokenType::Not:
+        break;
+      case TokenType::And:
+      case TokenType::Or:
+        if (!lhs.is<BoolLiteral>() || !rhs.is<BoolLiteral>()) {
+          return {};
+        }
+        break;
+      case TokenType::Greater:
+      case TokenType::Less:
+      case TokenType::GreaterEquals:
+      case TokenType::LessEquals:
+        if (!is_numeric(lhs) || !is_numeric(rhs)) {
+          return {};
+        }
+        break;
+      default:
+        return {};
+    }
+
+    return m_operators.eval_boolean(lhs, rhs, bool_expr.operand);
+  }
+
+  // A function is pure when it only uses its own variables and calls nothing but itself, so the
+  // same arguments always give the same result and running it has no other effect
+  static bool is_pure(const FunctionDeclaration& function_dec) {
+    return std::all_of(function_dec.body.begin(), function_dec.body.end(), [&](const Stmt& stmt) {
+      return is_pure(stmt, function_dec);
+    });
+  }
+
+  static bool is_pure(const std::vector<Stmt>& body, const FunctionDeclaration& function_dec) {
+    return std::all_of(body.begin(), body.end(), [&](const Stmt& stmt) {
+      return is_pure(stmt, function_dec);
+    });
+  }
+
+  static bool is_pure(const Stmt& stmt, const FunctionDeclaration& function_dec) {
+    return stmt.visit(overloaded {
+      [&](const Expr& expr) {
+        return is_pure(expr, function_dec);
+      },
+      [&](const VarDeclaration& declaration) {
+        return !declaration.expr.has_value() || is_pure(declaration.expr.value(), function_dec);
+      },
+      [&](const VarAssignment& assignment) {
+        return assignment.identifier.depth == 0 && is_pure(assignment.expr, function_dec);
+      },
+      // Nested functions close over the call's frame
+      [](const FunctionDeclaration&) {
+        return false;
+      },
+      [&](const ConditionalBlock& block) {
+        return std::all_of(block.stmts.begin(), block.stmts.end(), [&](const ConditionalStmt& conditional) {
+          return (!conditional.condition.has_value() || is_pure(conditional.condition.value(), function_dec))
+            && is_pure(conditional.body, function_dec);
+        });
+      },
+      [&](const ForLoop& loop) {
+        return loop.variable.identifier.depth == 0 && is_pure(loop.variable.expr, function_dec)
+          && is_pure(loop.condition, function_dec) && is_pure(loop.counter, function_dec)
+          && is_pure(loop.body, function_dec);
+      },
+      [&](const WhileLoop& loop) {
+        return is_pure(loop.condition, function_dec) && is_pure(loop.body, function_dec);
+      }
+    });
+  }
+
+  static bool is_pure(const BoolExpr& bool_expr, const FunctionDeclaration& function_dec) {
+    return is_pure(bool_expr.lhs, function_dec) && is_pure(bool_expr.rhs, function_dec);
+  }
+
+  static bool is_pure(const Expr& expr, const FunctionDeclaration& function_dec) {
+    return expr.visit(overloaded {
+      [](const Identifier& ident) {
+        return ident.depth == 0;
+      },
+      [&](const BinaryExpr& bin_expr) {
+        return is_pure(bin_expr.lhs, function_dec) && is_pure(bin_expr.rhs, function_dec);
+      },
+      [&](const BoolExpr& bool_expr) {
+        return is_pure(bool_expr, function_dec);
+      },
+      [&](const ObjectLiteral& object) {
+        return std::all_of(object.properties.begin(), object.properties.end(), [&](const Property& property) {
+          return is_pure(property.value.value(), function_dec);
+        });
+      },
+      // The function's own name is declared in the enclosing frame and is constant
+      [&](const CallExpr& call_expr) {
+        const Identifier& caller = call_expr.caller.get<Identifier>();
+        return caller.depth == 1 && caller.slot == function_dec.name.slot
+          && caller.token.symbol == function_dec.name.token.symbol
+          && is_pure(call_expr.args, function_dec);
+      },
+      [](const MemberExpr& member_expr) {
+        return member_expr.object.depth == 0;
+      },
+      [](const Increment& increment) {
+        return increment.identifier.depth == 0;
+      },
+      [&](const ReturnExpr& return_expr) {
+        return is_pure(return_expr.expr, function_dec);
+      },
+      // Literals
+      [](const auto&) {
+        return true;
+      }
+    });
+  }
+
+  static bool is_literal(const Expr& expr) {
+    return expr.is<NullLiteral>() || expr.is<IntLiteral>() || expr.is<FloatLiteral>()
+      || expr.is<StringLiteral>() || expr.is<BoolLiteral>();
+  }
+
+  static bool is_numeric(const RuntimeVal& value) {
+    return value.is<IntLiteral>() || value.is<FloatLiteral>();
+  }
+
+  static bool is_zero(const RuntimeVal& value) {
+    return value.is<IntLiteral>() ? value.get<IntLiteral>().value == 0 : value.get<FloatLiteral>().value == 0.0;
+  }
+
+  static RuntimeVal to_value(const Expr& literal) {
+    return literal.visit(overloaded {
+      [](const IntLiteral& value) -> RuntimeVal { return value; },
+      [](const FloatLiteral& value) -> RuntimeVal { return value; },
+      [](const StringLiteral& value) -> RuntimeVal { return value; },
+      [](const BoolLiteral& value) -> RuntimeVal { return value; },
+      [](const auto&) -> RuntimeVal { return NullLiteral(); }
+    });
+  }
+
+  // Turn a folded value back into a literal node, placed on the line of the expression it replaces
+  static Expr to_literal(const RuntimeVal& value, int line) {
+    return value.visit(overloaded {
+      [line](IntLiteral literal) -> Expr { literal.token.line = line; return literal; },
+      [line](FloatLiteral literal) -> Expr { literal.token.line = line; return literal; },
+      [line](StringLiteral literal) -> Expr { literal.token.line = line; return literal; },
+      [line](BoolLiteral literal) -> Expr { literal.token.line = line; return literal; },
+      [](const auto&) -> Expr { return NullLiteral(); }
+    });
+  }
+
+  const std::optional<Expr>& find_constant(const Identifier& identifier) {
+    static const std::optional<Expr> none;
+    if (identifier.depth >= m_functions.size()) {
+      return none;
+    }
+
+    const Constants& constants = m_functions[m_functions.size() - 1 - identifier.depth];
+    return identifier.slot < constants.size() ? constants[identifier.slot] : none;
+  }
+
+  // Slots are reused once a block ends, so every write to a slot replaces what is known about it
+  void set_constant(const Identifier& identifier, std::optional<Expr> value) {
+    if (identifier.depth >= m_functions.size()) {
+      return;
+    }
+
+    Constants& constants = m_functions[m_functions.size() - 1 - identifier.depth];
+    if (identifier.slot >= constants.size()) {
+      constants.resize(identifier.slot + 1);
+    }
+
+    constants[identifier.slot] = std::move(value);
+  }
+
+  void report(const std::string& change, const Token& token) {
+    if (m_debug) {
+      std::cerr << "Optimizer: line " << token.line << ": " << change << "\n";
+    }
+  }
+
+private:
+  Operators m_operators;
+  bool m_debug;
+  std::vector<Constants> m_functions;
+  Arena* m_arena = nullptr;
+  size_t m_folded = 0;
+  size_t m_propagated = 0;
+  size_t m_removed = 0;
+  size_t m_pure = 0;
+};
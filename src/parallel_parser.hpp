@@ -0,0 +1,191 @@
+#pragma once
+
+#include "parser.hpp"
+#include "tokenizer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <thread>
+
+// Tokenizes and parses a large program on several threads. The source is cut into chunks
+// before lines that start a top level statement, each chunk is tokenized against its own symbol
+// table, its symbols are mapped onto the global table in source order, and it is parsed into
+// its own arena. The chunks' statements are then joined in order into one Program. Errors are
+// held by each chunk until every thread is done, then the earliest one is reported.
+class ParallelParser {
+public:
+  // Chunks smaller than this are not worth a thread
+  static constexpr size_t min_chunk_size = 64 * 1024;
+
+  ParallelParser(std::string_view source, Error& error, size_t jobs)
+    : m_source(source), m_error(error), m_jobs(std::max<size_t>(jobs, 1))
+  {
+  }
+
+  Program create_ast() {
+    std::vector<Chunk> chunks = split();
+
+    for_each(chunks, [](Chunk& chunk) {
+      Error error{ Error::Defer() };
+      try {
+        Tokenizer tokenizer(chunk.text, error, chunk.line, chunk.symbols);
+        chunk.tokens = tokenizer.tokenize();
+      } catch (Error::Deferred& deferred) {
+        chunk.error = std::move(deferred);
+      }
+    });
+
+    // A serial run tokenizes the whole source before parsing any of it
+    report_first_error(chunks);
+
+    // Names are interned in the order they first appear, so symbols match a serial run
+    for (Chunk& chunk : chunks) {
+      chunk.global_symbols.reserve(chunk.symbols.size());
+      for (Symbol symbol = 0; symbol < chunk.symbols.size(); ++symbol) {
+        chunk.global_symbols.emplace_back(SymbolTable::global().intern(chunk.symbols.name(symbol)));
+      }
+    }
+
+    for_each(chunks, [](Chunk& chunk) {
+      for (Token& token : chunk.tokens) {
+        token.symbol = chunk.global_symbols[token.symbol];
+      }
+
+      Error error{ Error::Defer() };
+      try {
+        Parser parser(chunk.tokens, error);
+        chunk.program = parser.create_ast();
+      } catch (Error::Deferred& deferred) {
+        chunk.error = std::move(deferred);
+      }
+
+      chunk.tokens = {};
+    });
+
+    report_first_error(chunks);
+
+    // The joined program keeps every chunk's arena alive
+    Program program;
+    program.arena = std::make_shared<Arena>();
+    for (Chunk& chunk : chunks) {
+      program.arena->adopt(chunk.program.arena);
+      std::move(chunk.program.stmts.begin(), chunk.program.stmts.end(), std::back_inserter(program.stmts));
+    }
+
+    return program;
+  }
+
+private:
+  struct Chunk {
+    std::string_view text;
+    int line;
+    SymbolTable symbols;
+    std::vector<Symbol> global_symbols;
+    std::vector<Token> tokens;
+    Program program;
+    std::optional<Error::Deferred> error;
+  };
+
+  // Chunks are in source order, so the first error is the one a serial run would report
+  void report_first_error(const std::vector<Chunk>& chunks) {
+    for (const Chunk& chunk : chunks) {
+      if (chunk.error.has_value()) {
+        m_error.report_error(chunk.error->message, chunk.error->token);
+      }
+    }
+  }
+
+  // Cut the source into about four chunks per job. A chunk ends at a new line outside of any
+  // brackets, string or comment that is followed by a statement keyword, since no statement
+  // can continue onto such a line.
+  std::vector<Chunk> split() const {
+    size_t target = std::max(m_source.size() / (m_jobs * 4), min_chunk_size);
+    std::vector<Chunk> chunks;
+    size_t start = 0;
+    int start_line = 1;
+    int line = 1;
+    int depth = 0;
+
+    for (size_t pos = 0; pos < m_source.size(); ++pos) {
+      switch (m_source[pos]) {
+        // New lines inside strings are not counted as lines, as in the Tokenizer
+        case '"':
+          pos = std::min(scan::find(m_source, pos + 1, '"'), m_source.size());
+          break;
+        case '#':
+          pos = std::min(scan::find(m_source, pos, '\n'), m_source.size()) - 1;
+          break;
+        case '(':
+        case '{':
+        case '[':
+          ++depth;
+          break;
+        case ')':
+        case '}':
+        case ']':
+          --depth;
+          break;
+        case '\n':
+          ++line;
+          if (depth == 0 && pos + 1 - start >= target && starts_statement(pos + 1)) {
+            chunks.emplace_back().text = m_source.substr(start, pos + 1 - start);
+            chunks.back().line = start_line;
+            start = pos + 1;
+            start_line = line;
+          }
+          break;
+      }
+    }
+
+    chunks.emplace_back().text = m_source.substr(start);
+    chunks.back().line = start_line;
+    return chunks;
+  }
+
+  // Whether the line starting at pos begins with a keyword that starts a statement
+  bool starts_statement(size_t pos) const {
+    while (pos < m_source.size() && (m_source[pos] == ' ' || m_source[pos] == '\t')) {
+      ++pos;
+    }
+
+    std::string_view word = m_source.substr(pos, scan::skip_word(m_source, pos) - pos);
+    switch (keywords::find(word)) {
+      case TokenType::Fn:
+      case TokenType::Let:
+      case TokenType::Const:
+      case TokenType::If:
+      case TokenType::For:
+      case TokenType::While:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // Run work on every chunk, spread over the jobs with this thread taking part
+  template<typename F>
+  void for_each(std::vector<Chunk>& chunks, F work) const {
+    std::atomic<size_t> next = 0;
+    auto worker = [&]() {
+      for (size_t idx = next++; idx < chunks.size(); idx = next++) {
+        work(chunks[idx]);
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t job = 1; job < std::min(m_jobs, chunks.size()); ++job) {
+      threads.emplace_back(worker);
+    }
+
+    worker();
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+private:
+  std::string_view m_source;
+  Error& m_error;
+  size_t m_jobs;
+};
@@ -1,17 +1,32 @@
 #pragma once
 
 #include "error.hpp"
+#include "token_stream.hpp"
 #include "values/ast.hpp"
 
+#include <charconv>
+#include <span>
+
 class Parser {
 public:
-  explicit Parser(std::vector<Token> tokens, Error error)
-    : m_tokens(std::move(tokens)), m_error(std::move(error)), m_idx(0)
+  explicit Parser(const std::vector<Token>& tokens, Error& error)
+    : m_tokens(tokens), m_error(error), m_idx(0)
+  {
+  }
+
+  // Parse tokens as they are read from the stream. Function declarations are allocated in the
+  // given arena, other statements in the current one.
+  Parser(TokenStream& stream, Error& error, Arena& functions)
+    : m_error(error), m_idx(0), m_stream(&stream), m_functions(&functions)
   {
   }
 
+  // Every node of the tree is allocated in the program's arena
   Program create_ast() {
     Program program;
+    program.arena = std::make_shared<Arena>();
+    Arena::Scope scope(*program.arena);
+    m_functions = program.arena.get();
     
     while (not_eof()) {
       program.stmts.emplace_back(parse_stmt());
@@ -20,6 +35,15 @@ public:
     return program; 
   }
 
+  // The next top level statement read from the stream, or nothing at the end of the input
+  std::optional<Stmt> parse_next() {
+    if (!not_eof()) {
+      return std::nullopt;
+    }
+
+    return parse_stmt();
+  }
+
 private:
   // Handle complex statement types
   Stmt parse_stmt() {
@@ -71,8 +95,10 @@ private:
     return variable;
   }
 
-  // Handle function declaration
+  // Handle function declaration, functions can be called long after the statement declaring
+  // them has run so they always live in the program's arena
   Stmt parse_fn_declaration() {
+    Arena::Scope scope(*m_functions);
     pop();
     Identifier name = { expect(TokenType::Identifier, 
       "Expected identifier following fucntion declaration keyword.") };
@@ -83,7 +109,7 @@ private:
     for (Stmt arg : args) {
       // Ensure argument is an identifier
       auto expr = arg.get_if<Expr>();
-      auto ident = expr->get_if<Identifier>();
+      auto ident = expr ? expr->get_if<Identifier>() : nullptr;
       if (!expr || !ident) {
         m_error.report_error("Function parmaters must be of type `Identifier`.", peek(-1).value());
       }
@@ -332,6 +358,11 @@ private:
 
   // Parses a call expression
   CallExpr parse_call_expr(Expr caller) {
+    // Only named functions can be called
+    if (!caller.is<Identifier>()) {
+      m_error.report_error("Function calls must be made on an identifier.", peek().value());
+    }
+
     CallExpr call_expr{ parse_args(), caller }; 
 
     // If the next token is still an open parenthesis, it's a nested call
@@ -403,14 +434,35 @@ private:
       } 
       // Constants and Numeric Constants
       case TokenType::Int: {
-        return IntLiteral{ token };
+        IntLiteral literal{ token, parse_number<int64_t>(token) };
+        if (m_stream) {
+          literal.token.raw_value = streamed_number_text(token, std::to_string(literal.value));
+        }
+
+        return literal;
       }
       case TokenType::Float: {
-        return FloatLiteral{ token };
+        FloatLiteral literal{ token, parse_number<double>(token) };
+        if (m_stream) {
+          int decimals = token.raw_value->size() - token.raw_value->find('.') - 1;
+          literal.token.raw_value = streamed_number_text(token, FloatLiteral::format(literal.value, decimals));
+          if (!literal.token.raw_value.has_value()) {
+            literal.decimals = decimals;
+          }
+        }
+
+        return literal;
       }
       // String Value
       case TokenType::String: {
-        return StringLiteral{ token };
+        // A streamed string owns a copy of its text, freed with the last value holding it
+        StringLiteral literal{ token };
+        if (m_stream) {
+          literal.owned = std::make_shared<const std::string>(token.text());
+          literal.token.raw_value = *literal.owned;
+        }
+
+        return literal;
       }
       // Boolean Value
       case TokenType::True: {
@@ -448,16 +500,39 @@ private:
     }
   }
 
-  [[nodiscard]] std::optional<Token> peek(int ahead = 0) const { 
-    if (m_idx + ahead >= m_tokens.size()) {
+  [[nodiscard]] std::optional<Token> peek(int ahead = 0) { 
+    if (m_idx + ahead >= m_tokens.size() && !pull(m_idx + ahead)) {
       return {};
     }
 
-    return m_tokens.at(m_idx + ahead);
+    return m_tokens[m_idx + ahead];
   }
 
   Token pop() {
-    return m_tokens.at(m_idx++);
+    Token token = peek().value();
+    ++m_idx;
+    return token;
+  }
+
+  // Read streamed tokens until index is in the window, keeping only the previous token for
+  // error messages. False when the stream ends first.
+  bool pull(size_t index) {
+    if (!m_stream || index == static_cast<size_t>(-1)) {
+      return false;
+    }
+
+    if (m_idx > 1) {
+      m_window.erase(m_window.begin(), m_window.begin() + (m_idx - 1));
+      index -= m_idx - 1;
+      m_idx = 1;
+    }
+
+    while (m_window.size() <= index && (m_window.empty() || m_window.back().type != TokenType::EndOfFile)) {
+      m_window.emplace_back(m_stream->next());
+    }
+
+    m_tokens = m_window;
+    return index < m_window.size();
   }
 
   Token expect(TokenType expected_type, std::string message) {
@@ -471,12 +546,41 @@ private:
     return token;
   }
 
-  constexpr bool not_eof() {
-    return m_tokens.at(m_idx).type != TokenType::EndOfFile;
+  // Streamed text is overwritten soon after it is read. A number that prints the same from its
+  // value needs none, and only rare spellings such as leading zeros are interned to keep them.
+  std::optional<std::string_view> streamed_number_text(const Token& token, const std::string& printed) {
+    if (token.raw_value.value() == printed) {
+      return std::nullopt;
+    }
+
+    return SymbolTable::global().name(SymbolTable::global().intern(token.raw_value.value()));
+  }
+
+  // Convert the token's text in place without copying it into a string first
+  template<typename T>
+  T parse_number(const Token& token) {
+    std::string_view text = token.raw_value.value();
+    T value{};
+
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc() || end != text.data() + text.size()) {
+      m_error.report_error("Numeric literal `" + token.text() + "` is out of range.", token);
+    }
+
+    return value;
+  }
+
+  bool not_eof() {
+    return peek().value().type != TokenType::EndOfFile;
   }
 
 private:
-  const std::vector<Token> m_tokens;
-  Error m_error;
+  std::span<const Token> m_tokens;
+  Error& m_error;
   size_t m_idx;
+
+  // Tokens read so far from a stream
+  TokenStream* m_stream = nullptr;
+  std::vector<Token> m_window;
+  Arena* m_functions = nullptr;
 };
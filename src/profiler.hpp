@@ -0,0 +1,138 @@
+#pragma once
+
+#include "values/ast.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <algorithm>
+
+#include <signal.h>
+#include <sys/time.h>
+
+// Sampling profiler for Wetpaint code. A CPU timer signal marks a sample as pending and the
+// running engine records its call stack of function names and lines at its next safe point,
+// so nothing is done inside the signal handler itself.
+class Profiler {
+public:
+  // One level of the Wetpaint call stack, the program body has the empty symbol
+  struct Frame {
+    Symbol function;
+    int line;
+  };
+
+  explicit Profiler(std::chrono::microseconds interval = std::chrono::microseconds(1000)) {
+    struct sigaction action {};
+    action.sa_handler = [](int) { s_pending.store(true, std::memory_order_relaxed); };
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGPROF, &action, nullptr);
+
+    struct itimerval timer {};
+    timer.it_interval.tv_sec = interval.count() / 1000000;
+    timer.it_interval.tv_usec = interval.count() % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+  }
+
+  ~Profiler() {
+    struct itimerval timer {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+  }
+
+  Profiler(const Profiler&) = delete;
+  Profiler& operator=(const Profiler&) = delete;
+
+  // Checked by the engines at every safe point, kept to a single relaxed load
+  static bool pending() {
+    return s_pending.load(std::memory_order_relaxed);
+  }
+
+  // Record the call stack, outermost frame first
+  void record(const std::vector<Frame>& stack) {
+    s_pending.store(false, std::memory_order_relaxed);
+    if (stack.empty()) {
+      return;
+    }
+
+    ++m_total;
+
+    std::string collapsed;
+    for (const Frame& frame : stack) {
+      if (!collapsed.empty()) {
+        collapsed += ';';
+      }
+      collapsed += label(frame);
+    }
+    ++m_stacks[collapsed];
+
+    const Frame& top = stack.back();
+    ++m_self[{ top.function, top.line }];
+
+    // Count each function once per sample even when it recurses
+    std::vector<Symbol> seen;
+    for (const Frame& frame : stack) {
+      if (std::find(seen.begin(), seen.end(), frame.function) == seen.end()) {
+        seen.emplace_back(frame.function);
+        ++m_inclusive[frame.function];
+      }
+    }
+  }
+
+  // Print the flat profile and write the collapsed stacks for flamegraph tools
+  void report(std::ostream& out, const std::string& collapsed_path) const {
+    out << "Profile: " << m_total << " samples\n\n";
+    if (m_total == 0) {
+      return;
+    }
+
+    std::vector<std::pair<std::pair<Symbol, int>, size_t>> lines(m_self.begin(), m_self.end());
+    std::sort(lines.begin(), lines.end(), [](const auto& lhs, const auto& rhs) { return lhs.second > rhs.second; });
+
+    out << "   self%   samples  line\n";
+    for (const auto& [location, samples] : lines) {
+      print_row(out, samples, label(Frame{ location.first, location.second }));
+    }
+
+    std::vector<std::pair<Symbol, size_t>> functions(m_inclusive.begin(), m_inclusive.end());
+    std::sort(functions.begin(), functions.end(), [](const auto& lhs, const auto& rhs) { return lhs.second > rhs.second; });
+
+    out << "\n  total%   samples  function\n";
+    for (const auto& [function, samples] : functions) {
+      print_row(out, samples, name(function));
+    }
+
+    std::ofstream collapsed(collapsed_path);
+    for (const auto& [stack, samples] : m_stacks) {
+      collapsed << stack << ' ' << samples << '\n';
+    }
+
+    out << "\nCollapsed stacks written to " << collapsed_path << "\n";
+  }
+
+private:
+  static std::string name(Symbol function) {
+    return function == SymbolTable::empty ? "<main>" : std::string(SymbolTable::global().name(function));
+  }
+
+  static std::string label(const Frame& frame) {
+    return name(frame.function) + ":" + std::to_string(frame.line);
+  }
+
+  void print_row(std::ostream& out, size_t samples, const std::string& label) const {
+    char percent[16];
+    std::snprintf(percent, sizeof(percent), "%7.2f%%", 100.0 * samples / m_total);
+    out << ' ' << percent << ' ' << std::string(9 - std::min<size_t>(9, std::to_string(samples).size()), ' ')
+        << samples << "  " << label << '\n';
+  }
+
+private:
+  inline static std::atomic<bool> s_pending = false;
+
+  size_t m_total = 0;
+  std::map<std::string, size_t> m_stacks;
+  std::map<std::pair<Symbol, int>, size_t> m_self;
+  std::map<Symbol, size_t> m_inclusive;
+};
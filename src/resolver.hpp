@@ -0,0 +1,310 @@
+#pragma once
+
+#include "environment.hpp"
+
+// Binds every variable reference in a Program to the frame depth and slot it lives in
+class Resolver {
+public:
+  explicit Resolver(Error& error)
+    : m_error(error)
+  {
+  }
+
+  Program resolve(const Program& program) {
+    begin_program(*program.arena);
+
+    // The resolved tree is built in the same arena as the parsed one
+    Program resolved;
+    resolved.arena = program.arena;
+    Arena::Scope scope(*resolved.arena);
+
+    for (const Stmt& stmt : program.stmts) {
+      resolved.stmts.emplace_back(resolve_stmt(stmt));
+    }
+
+    resolved.slot_count = end_function();
+    return resolved;
+  }
+
+  // Start a program whose top level statements are resolved one at a time by resolve_next.
+  // Function declarations are built in the given arena, everything else in the current one.
+  void begin_program(Arena& functions) {
+    m_arena = &functions;
+    begin_function();
+
+    // Native functions occupy the first global slots
+    for (const auto& [name, call] : Environment::native_functions()) {
+      declare(Identifier{ Token{ TokenType::Identifier, 0, name, SymbolTable::global().intern(name) } }, false);
+    }
+  }
+
+  Stmt resolve_next(const Stmt& stmt) {
+    return resolve_stmt(stmt);
+  }
+
+  // Global slots used by the statements resolved so far
+  size_t global_slot_count() const {
+    return m_functions.front().slot_count;
+  }
+
+private:
+  struct Local {
+    Symbol name;
+    uint16_t slot;
+    bool constant;
+  };
+
+  struct FunctionScope {
+    std::vector<Local> locals;
+    std::vector<size_t> blocks;
+    size_t slot_count = 0;
+  };
+
+  Stmt resolve_stmt(const Stmt& stmt) {
+    return stmt.visit(overloaded {
+      [this](const Expr& expr) -> Stmt {
+        return resolve_expr(expr);
+      },
+      [this](const VarDeclaration& declaration) -> Stmt {
+        VarDeclaration resolved = declaration;
+        if (declaration.expr.has_value()) {
+          resolved.expr = resolve_expr(declaration.expr.value());
+        }
+
+        resolved.identifier = declare(declaration.identifier, declaration.constant);
+        return resolved;
+      },
+      [this](const VarAssignment& assignment) -> Stmt {
+        return VarAssignment{ resolve_assignment(assignment.identifier), resolve_expr(assignment.expr) };
+      },
+      [this](const FunctionDeclaration& function_dec) -> Stmt {
+        Arena::Scope scope(*m_arena);
+        FunctionDeclaration resolved = function_dec;
+
+        // Declare the name first so the function can call itself
+        resolved.name = declare(function_dec.name, true);
+
+        begin_function();
+        resolved.params.clear();
+        for (const Identifier& param : function_dec.params) {
+          resolved.params.emplace_back(declare(param, false));
+        }
+
+        resolved.body = resolve_body(function_dec.body);
+        resolved.slot_count = end_function();
+        return resolved;
+      },
+      [this](const ConditionalBlock& block) -> Stmt {
+        ConditionalBlock resolved;
+        for (const ConditionalStmt& stmt : block.stmts) {
+          ConditionalStmt conditional{ stmt.type };
+          if (stmt.condition.has_value()) {
+            conditional.condition = resolve_bool_expr(stmt.condition.value());
+          }
+
+          begin_block();
+          conditional.body = resolve_body(stmt.body);
+          end_block();
+
+          resolved.stmts.emplace_back(std::move(conditional));
+        }
+
+        return resolved;
+      },
+      [this](const ForLoop& loop) -> Stmt {
+        ForLoop resolved = loop;
+        begin_block();
+
+        // Reuse an existing variable or declare one scoped to the loop
+        Expr init = resolve_expr(loop.variable.expr);
+        if (find(loop.variable.identifier).has_value()) {
+          resolved.variable = VarAssignment{ resolve_assignment(loop.variable.identifier), init };
+        } else {
+          resolved.variable = VarAssignment{ declare(loop.variable.identifier, false), init };
+          resolved.declares_variable = true;
+        }
+
+        resolved.condition = resolve_bool_expr(loop.condition);
+        resolved.counter = resolve_expr(loop.counter);
+
+        begin_block();
+        resolved.body = resolve_body(loop.body);
+        end_block();
+
+        end_block();
+        return resolved;
+      },
+      [this](const WhileLoop& loop) -> Stmt {
+        WhileLoop resolved{ resolve_bool_expr(loop.condition) };
+
+        begin_block();
+        resolved.body = resolve_body(loop.body);
+        end_block();
+
+        return resolved;
+      }
+    });
+  }
+
+  Expr resolve_expr(const Expr& expr) {
+    return expr.visit(overloaded {
+      [this](const Identifier& ident) -> Expr {
+        return resolve_reference(ident);
+      },
+      [this](const BinaryExpr& bin_expr) -> Expr {
+        return BinaryExpr{ resolve_expr(bin_expr.lhs), resolve_expr(bin_expr.rhs), bin_expr.operand };
+      },
+      [this](const BoolExpr& bool_expr) -> Expr {
+        return resolve_bool_expr(bool_expr);
+      },
+      [this](const ObjectLiteral& object) -> Expr {
+        ObjectLiteral resolved;
+        for (const Property& property : object.properties) {
+          // Shorthand properties read the variable with the same name
+          Expr value = property.value.has_value()
+            ? resolve_expr(property.value.value())
+            : Expr{ resolve_reference(property.key) };
+
+          resolved.properties.emplace_back(Property{ property.key, value });
+        }
+
+        return resolved;
+      },
+      [this](const CallExpr& call_expr) -> Expr {
+        CallExpr resolved{ {}, resolve_expr(call_expr.caller) };
+        for (const Stmt& arg : call_expr.args) {
+          resolved.args.emplace_back(resolve_stmt(arg));
+        }
+
+        return resolved;
+      },
+      [this](const MemberExpr& member_expr) -> Expr {
+        // Only the object is a variable, members are property names
+        return MemberExpr{ resolve_reference(member_expr.object), member_expr.member };
+      },
+      [this](const Increment& increment) -> Expr {
+        return Increment{ resolve_assignment(increment.identifier), increment.operand };
+      },
+      [this](const ReturnExpr& return_expr) -> Expr {
+        return ReturnExpr{ resolve_expr(return_expr.expr) };
+      },
+      // Literals have nothing to resolve
+      [](const auto& literal) -> Expr {
+        return literal;
+      }
+    });
+  }
+
+  BoolExpr resolve_bool_expr(const BoolExpr& bool_expr) {
+    return BoolExpr{ resolve_expr(bool_expr.lhs), resolve_expr(bool_expr.rhs), bool_expr.operand };
+  }
+
+  std::vector<Stmt> resolve_body(const std::vector<Stmt>& body) {
+    std::vector<Stmt> resolved;
+    for (const Stmt& stmt : body) {
+      resolved.emplace_back(resolve_stmt(stmt));
+    }
+
+    return resolved;
+  }
+
+  void begin_function() {
+    m_functions.emplace_back();
+  }
+
+  size_t end_function() {
+    size_t slot_count = m_functions.back().slot_count;
+    m_functions.pop_back();
+    return slot_count;
+  }
+
+  // Variables declared inside a block free their slots when the block ends
+  void begin_block() {
+    m_functions.back().blocks.emplace_back(m_functions.back().locals.size());
+  }
+
+  void end_block() {
+    FunctionScope& function = m_functions.back();
+    function.locals.resize(function.blocks.back());
+    function.blocks.pop_back();
+  }
+
+  Identifier declare(const Identifier& identifier, bool constant) {
+    FunctionScope& function = m_functions.back();
+    Symbol name = identifier.token.symbol;
+
+    // Check if variable was declared already in this function
+    for (const Local& local : function.locals) {
+      if (local.name == name) {
+        m_error.report_error("Variable `" + identifier.token.text() + "` is already declared.", identifier.token);
+      }
+    }
+
+    // Slots are 16 bit in identifiers and bytecode operands, so both engines stop here
+    if (function.locals.size() > UINT16_MAX) {
+      m_error.report_error("Too many variables in scope, at most " + std::to_string(UINT16_MAX + 1) +
+          " can be declared in one function at once.", identifier.token);
+    }
+
+    uint16_t slot = function.locals.size();
+    function.locals.emplace_back(Local{ name, slot, constant });
+    function.slot_count = std::max(function.slot_count, function.locals.size());
+
+    Identifier resolved = identifier;
+    resolved.depth = 0;
+    resolved.slot = slot;
+    return resolved;
+  }
+
+  Identifier resolve_reference(const Identifier& identifier) {
+    auto resolved = find(identifier);
+    if (!resolved.has_value()) {
+      m_error.report_error("Variable `" + identifier.token.text() + "` was never declared in scope.",
+          identifier.token);
+    }
+
+    return resolved->first;
+  }
+
+  Identifier resolve_assignment(const Identifier& identifier) {
+    auto resolved = find(identifier);
+    if (!resolved.has_value()) {
+      m_error.report_error("Variable `" + identifier.token.text() + "` was never declared.",
+          identifier.token);
+    }
+
+    // If the variable is a constant, report an error
+    if (resolved->second) {
+      m_error.report_error("Cannot reassign constant variable `" +
+          identifier.token.text() + "`.", identifier.token);
+    }
+
+    return resolved->first;
+  }
+
+  // Search the enclosing functions from the innermost outwards, returning the bound identifier
+  // and whether it is constant
+  std::optional<std::pair<Identifier, bool>> find(const Identifier& identifier) {
+    Symbol name = identifier.token.symbol;
+
+    for (size_t depth = 0; depth < m_functions.size(); ++depth) {
+      const FunctionScope& function = m_functions[m_functions.size() - 1 - depth];
+
+      for (auto it = function.locals.rbegin(); it != function.locals.rend(); ++it) {
+        if (it->name == name) {
+          Identifier resolved = identifier;
+          resolved.depth = depth;
+          resolved.slot = it->slot;
+          return std::make_pair(resolved, it->constant);
+        }
+      }
+    }
+
+    return {};
+  }
+
+private:
+  Error& m_error;
+  std::vector<FunctionScope> m_functions;
+  Arena* m_arena = nullptr;
+};
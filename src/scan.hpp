@@ -0,0 +1,128 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Helpers that skip runs of one kind of character in the source, used by the Tokenizer.
+// With SSE2 they test 16 bytes at a time and finish the last partial block byte by byte.
+namespace scan {
+  constexpr bool is_word(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+  }
+
+  constexpr bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+  }
+
+  // Whitespace, including new lines
+  constexpr bool is_blank(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+  }
+
+#if defined(__SSE2__)
+  inline __m128i load(const char* data) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+  }
+
+  // Bytes between low and high inclusive, bytes above 127 compare as negative and never match
+  inline __m128i in_range(__m128i block, char low, char high) {
+    return _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8(low - 1)), _mm_cmplt_epi8(block, _mm_set1_epi8(high + 1)));
+  }
+
+  inline uint32_t word_mask(const char* data) {
+    __m128i block = load(data);
+    __m128i lower = _mm_or_si128(block, _mm_set1_epi8(0x20));
+    __m128i matches = _mm_or_si128(in_range(lower, 'a', 'z'), in_range(block, '0', '9'));
+    matches = _mm_or_si128(matches, _mm_cmpeq_epi8(block, _mm_set1_epi8('_')));
+    return _mm_movemask_epi8(matches);
+  }
+
+  inline uint32_t digit_mask(const char* data) {
+    return _mm_movemask_epi8(in_range(load(data), '0', '9'));
+  }
+
+  // Tab, new line, vertical tab, form feed and carriage return are the range 9 to 13
+  inline uint32_t blank_mask(const char* data) {
+    __m128i block = load(data);
+    __m128i matches = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')), in_range(block, '\t', '\r'));
+    return _mm_movemask_epi8(matches);
+  }
+
+  inline uint32_t newline_mask(const char* data) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(load(data), _mm_set1_epi8('\n')));
+  }
+#endif
+
+  // Position of the first character at or after pos that isn't part of a name
+  inline size_t skip_word(std::string_view text, size_t pos) {
+#if defined(__SSE2__)
+    for (; pos + 16 <= text.size(); pos += 16) {
+      uint32_t matches = word_mask(text.data() + pos);
+      if (matches != 0xFFFF) {
+        return pos + std::countr_one(matches);
+      }
+    }
+#endif
+    while (pos < text.size() && is_word(text[pos])) {
+      ++pos;
+    }
+
+    return pos;
+  }
+
+  inline size_t skip_digits(std::string_view text, size_t pos) {
+#if defined(__SSE2__)
+    for (; pos + 16 <= text.size(); pos += 16) {
+      uint32_t matches = digit_mask(text.data() + pos);
+      if (matches != 0xFFFF) {
+        return pos + std::countr_one(matches);
+      }
+    }
+#endif
+    while (pos < text.size() && is_digit(text[pos])) {
+      ++pos;
+    }
+
+    return pos;
+  }
+
+  // Skip whitespace, adding the new lines passed over to line
+  inline size_t skip_blank(std::string_view text, size_t pos, int& line) {
+#if defined(__SSE2__)
+    for (; pos + 16 <= text.size(); pos += 16) {
+      uint32_t matches = blank_mask(text.data() + pos);
+      uint32_t newlines = newline_mask(text.data() + pos);
+
+      if (matches != 0xFFFF) {
+        int length = std::countr_one(matches);
+        line += std::popcount(newlines & ((1u << length) - 1));
+        return pos + length;
+      }
+
+      line += std::popcount(newlines);
+    }
+#endif
+    while (pos < text.size() && is_blank(text[pos])) {
+      line += text[pos] == '\n';
+      ++pos;
+    }
+
+    return pos;
+  }
+
+  // Position of the next c at or after pos, or npos. memchr is already vectorised by the C library.
+  inline size_t find(std::string_view text, size_t pos, char c) {
+    if (pos >= text.size()) {
+      return std::string_view::npos;
+    }
+
+    const void* found = std::memchr(text.data() + pos, c, text.size() - pos);
+    return found ? static_cast<const char*>(found) - text.data() : std::string_view::npos;
+  }
+}
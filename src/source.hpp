@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Program text loaded once and shared by every stage as string views.
+// Regular files are memory mapped, anything that can't be mapped (pipes, empty files) is read into memory.
+class Source {
+public:
+  explicit Source(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      std::cerr << "Could not open file: " << path << "\n";
+      std::exit(EXIT_FAILURE);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+      void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        m_mapped = static_cast<const char*>(data);
+        m_size = info.st_size;
+      }
+    }
+
+    if (!m_mapped) {
+      read_all(fd);
+    }
+
+    close(fd);
+  }
+
+  ~Source() {
+    if (m_mapped) {
+      munmap(const_cast<char*>(m_mapped), m_size);
+    }
+  }
+
+  // Views into the source must stay valid, so it is never copied or moved
+  Source(const Source&) = delete;
+  Source& operator=(const Source&) = delete;
+
+  std::string_view text() const {
+    return m_mapped ? std::string_view(m_mapped, m_size) : std::string_view(m_buffer);
+  }
+
+private:
+  void read_all(int fd) {
+    char chunk[4096];
+    ssize_t count;
+    while ((count = read(fd, chunk, sizeof(chunk))) > 0) {
+      m_buffer.append(chunk, count);
+    }
+  }
+
+private:
+  const char* m_mapped = nullptr;
+  size_t m_size = 0;
+  std::string m_buffer;
+};
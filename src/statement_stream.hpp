@@ -0,0 +1,64 @@
+#pragma once
+
+#include "parser.hpp"
+#include "resolver.hpp"
+#include "optimizer.hpp"
+
+// Reads a program one top level statement at a time, running each through the parser, resolver
+// and optimizer as soon as its tokens arrive, so it can start before the rest has been read.
+// A statement's nodes are freed when the next one is read, except for function declarations
+// which can still be called and live as long as the stream.
+class StatementStream {
+public:
+  StatementStream(const std::string& path, Error& error, bool debug_opt)
+    : m_functions(std::make_shared<Arena>()), m_tokens(path, error), m_parser(m_tokens, error, *m_functions),
+      m_resolver(error), m_optimizer(error, debug_opt)
+  {
+    m_resolver.begin_program(*m_functions);
+    m_optimizer.begin_program(*m_functions);
+  }
+
+  // The next statement ready to run, or nothing at the end of the input
+  std::optional<Stmt> next() {
+    m_statement.rewind(Arena::Mark{});
+    Arena::Scope scope(m_statement);
+
+    while (!m_done) {
+      std::optional<Stmt> parsed = m_parser.parse_next();
+      if (!parsed.has_value()) {
+        m_optimizer.end_program();
+        m_done = true;
+        break;
+      }
+
+      // Statements that can never have an effect are skipped
+      std::optional<Stmt> optimized = m_optimizer.optimize_next(m_resolver.resolve_next(parsed.value()));
+      if (optimized.has_value()) {
+        return optimized;
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  // Global slots declared by the statements read so far
+  size_t global_slot_count() const {
+    return m_resolver.global_slot_count();
+  }
+
+  // An empty program owning the arena of the functions declared by the stream
+  Program program() const {
+    Program program;
+    program.arena = m_functions;
+    return program;
+  }
+
+private:
+  std::shared_ptr<Arena> m_functions;
+  Arena m_statement;
+  TokenStream m_tokens;
+  Parser m_parser;
+  Resolver m_resolver;
+  Optimizer m_optimizer;
+  bool m_done = false;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "error.hpp"
+#include "tokenizer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Tokens read on demand from a file or pipe, a chunk of text at a time, so only a window of the
+// input is ever held in memory. The path `-` reads standard input.
+class TokenStream {
+public:
+  static constexpr size_t chunk_size = 64 * 1024;
+
+  TokenStream(const std::string& path, Error& error)
+    : m_error(error), m_tokenizer(std::string_view(), error, 0, 1, false)
+  {
+    m_fd = path == "-" ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+    if (m_fd < 0) {
+      std::cerr << "Could not open file: " << path << "\n";
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
+  ~TokenStream() {
+    if (m_fd != STDIN_FILENO) {
+      close(m_fd);
+    }
+  }
+
+  TokenStream(const TokenStream&) = delete;
+  TokenStream& operator=(const TokenStream&) = delete;
+
+  // The next token, EndOfFile once the input is exhausted. The text of a number or string is only
+  // valid until a few more literals have been read, the parser copies what it keeps before then.
+  Token next() {
+    Token token;
+    while (true) {
+      switch (m_tokenizer.scan(token)) {
+        case Tokenizer::Scan::Token:
+          keep_text(token);
+          return token;
+        case Tokenizer::Scan::End:
+          return Token{ TokenType::EndOfFile, m_tokenizer.line() };
+        case Tokenizer::Scan::Incomplete:
+          refill();
+          break;
+      }
+    }
+  }
+
+private:
+  // Literals view the buffer, which a refill moves, so their text is copied into the next of a
+  // few reused strings. That outlasts the tokens the parser looks ahead.
+  void keep_text(Token& token) {
+    if (token.type == TokenType::Int || token.type == TokenType::Float || token.type == TokenType::String) {
+      std::string& text = m_literals[m_next_literal++ % m_literals.size()];
+      text.assign(token.raw_value.value());
+      token.raw_value = text;
+    }
+  }
+
+  // Drop text scanned more than a chunk ago, from the start of a line so errors can still show
+  // recent lines, and read the next chunk after the rest
+  void refill() {
+    size_t pos = m_tokenizer.position();
+    size_t line_start = 0;
+    if (pos > chunk_size) {
+      size_t newline = m_buffer.find('\n', pos - chunk_size - 1);
+      line_start = newline == std::string::npos ? pos : std::min(newline + 1, pos);
+    }
+
+    int first_line = m_tokenizer.line() - std::count(m_buffer.begin() + line_start, m_buffer.begin() + pos, '\n');
+    m_buffer.erase(0, line_start);
+    pos -= line_start;
+
+    size_t size = m_buffer.size();
+    m_buffer.resize(size + chunk_size);
+    ssize_t count;
+    do {
+      count = read(m_fd, m_buffer.data() + size, chunk_size);
+    } while (count < 0 && errno == EINTR);
+
+    if (count < 0) {
+      std::cerr << "Could not read input\n";
+      std::exit(EXIT_FAILURE);
+    }
+
+    m_buffer.resize(size + count);
+    bool last = count == 0;
+
+    m_tokenizer = Tokenizer(m_buffer, m_error, pos, m_tokenizer.line(), last);
+    m_error.set_source(m_buffer, first_line);
+  }
+
+private:
+  Error& m_error;
+  int m_fd;
+  std::string m_buffer;
+  Tokenizer m_tokenizer;
+  std::array<std::string, 4> m_literals;
+  size_t m_next_literal = 0;
+};
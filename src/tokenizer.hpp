@@ -1,173 +1,235 @@
 #pragma once
 
+#include "error.hpp"
+#include "scan.hpp"
 #include "values/tokens.hpp"
 
+#include <array>
 #include <vector>
-#include <iostream>
-#include <unordered_map>
 
+// Splits the source into tokens whose text are views into the source, nothing is copied.
+// The source must outlive the tokens.
 class Tokenizer {
 public:
-  explicit Tokenizer(std::string src)
-    : m_src(std::move(src)), m_idx(0)
+  // Outcome of scanning for the next token
+  enum class Scan {
+    Token,
+    End,
+    // The window ended where a token might continue, scanning resumes at position()
+    Incomplete
+  };
+
+  // Text starting on the given line. Names are interned into symbols, which is only ever another
+  // table than the global one when chunks of a program are tokenized in parallel.
+  Tokenizer(std::string_view src, Error& error, int line = 1, SymbolTable& symbols = SymbolTable::global())
+    : m_src(src), m_error(&error), m_line(line), m_symbols(&symbols)
+  {
+  }
+
+  // A window onto a longer stream of text, starting at pos on the given line. Until the last
+  // window a token running into the end is left for the next one. As the text is then
+  // overwritten, identifiers view their name in the symbol table, while numbers and strings view
+  // the window and must be copied before it is refilled.
+  Tokenizer(std::string_view window, Error& error, size_t pos, int line, bool last)
+    : m_src(window), m_error(&error), m_pos(pos), m_line(line), m_streamed(true), m_partial(!last)
   {
   }
 
   std::vector<Token> tokenize() {
+    // Programs average under one token per three bytes, reserving avoids copying every token as
+    // the vector grows and untouched capacity is never paged in
     std::vector<Token> tokens;
-    std::string buffer;
-    int line_count = 1;
-
-    while(peek().has_value()) {
-      // Get keyword
-      if (isalpha(peek().value())) {
-        while (isalnum(peek().value()) || peek().value() == '_') {
-          buffer.push_back(pop());
-        }
+    tokens.reserve(m_src.size() / 3 + 1);
 
-        TokenType token = get_keyword(buffer);
+    Token token;
+    while (scan(token) == Scan::Token) {
+      tokens.emplace_back(token);
+    }
 
-        if (token == TokenType::Identifier) {
-          tokens.emplace_back(Token{ token, line_count, buffer });
-        } else {
-          tokens.emplace_back(Token{ token, line_count });
-        }
+    tokens.emplace_back(Token{ TokenType::EndOfFile, m_line });
+    return tokens;
+  }
 
-        buffer.clear();
+  // Scan the next token, skipping whitespace and comments
+  Scan scan(Token& token) {
+    size_t pos = m_pos;
+    int line_count = m_line;
+    Scan result = Scan::Token;
+
+    // The first character of each token decides what it is
+    while (true) {
+      if (pos >= m_src.size()) {
+        result = m_partial ? Scan::Incomplete : Scan::End;
+        break;
       }
-      
-      // Get number literal
-      else if (isdigit(peek().value())) {
-        while (isdigit(peek().value())) {
-          buffer.push_back(pop());
+
+      size_t start = pos;
+      char current = m_src[pos];
+      CharClass kind = char_classes[static_cast<uint8_t>(current)];
+      bool scanned = true;
+
+      switch (kind) {
+        // Skip whitespace, counting new lines
+        case CharClass::Blank: {
+          pos = scan::skip_blank(m_src, pos, line_count);
+          scanned = false;
+          break;
         }
 
-        // Tokenize floating point value if it exists
-        if (peek().value() == '.') {
-          buffer.push_back(pop());
+        // Get keyword or identifier
+        case CharClass::Letter: {
+          pos = scan::skip_word(m_src, pos + 1);
+
+          // Keywords are recognised before interning, only identifiers are interned
+          std::string_view word = m_src.substr(start, pos - start);
+          TokenType type = keywords::find(word);
+
+          if (type == TokenType::Identifier) {
+            Symbol symbol = m_symbols->intern(word);
+            token = Token{ type, line_count, stable(word, symbol), symbol };
+          } else {
+            token = Token{ type, line_count };
+          }
+          break;
+        }
 
-          while (isdigit(peek().value()))
-            buffer.push_back(pop());
+        // Get number literal, a fractional part makes it a float
+        case CharClass::Digit: {
+          pos = scan::skip_digits(m_src, pos + 1);
 
-          tokens.emplace_back(Token{ TokenType::Float, line_count, buffer });
-        }
+          TokenType type = TokenType::Int;
+          if (pos < m_src.size() && m_src[pos] == '.') {
+            pos = scan::skip_digits(m_src, pos + 1);
+            type = TokenType::Float;
+          }
 
-        // Tokenize integer
-        else {
-          tokens.emplace_back(Token{ TokenType::Int, line_count, buffer });
+          std::string_view text = m_src.substr(start, pos - start);
+          token = Token{ type, line_count, text };
+          break;
         }
 
-        buffer.clear();
-      }
+        // Get string, the view excludes the quotes
+        case CharClass::Quote: {
+          size_t end = scan::find(m_src, pos + 1, '"');
+          if (end == std::string_view::npos) {
+            if (m_partial) {
+              pos = m_src.size();
+              break;
+            }
+
+            m_error->report_error("Unterminated string.", Token{ TokenType::String, line_count });
+          }
+
+          // Streamed strings are compared by their text, interning them would keep every one forever
+          std::string_view text = m_src.substr(pos + 1, end - pos - 1);
+          token = Token{ TokenType::String, line_count, text, m_streamed ? SymbolTable::empty : m_symbols->intern(text) };
+          pos = end + 1;
+          break;
+        }
 
-      // Get string
-      else if (peek().value() == *"\"") {
-        pop();
-        while (peek().value() != *"\"") {
-          buffer.push_back(pop());
+        // Skip comment up to the new line, which is counted as whitespace
+        case CharClass::Comment: {
+          pos = std::min(scan::find(m_src, pos, '\n'), m_src.size());
+          scanned = false;
+          break;
         }
 
-        pop();
-        tokens.emplace_back(Token{ TokenType::String, line_count, buffer });
-        buffer.clear();
-      }
+        case CharClass::Symbol: {
+          token = Token{ symbol_types[static_cast<uint8_t>(current)], line_count };
+          ++pos;
+          break;
+        }
 
-      // Skip tokenizing comment
-      else if (peek().value() == '#') {
-        while (peek().has_value() && peek().value() != '\n') {
-          pop();
+        case CharClass::Invalid: {
+          m_error->report_error("Invalid character: `" + std::string(1, current) + "`.", Token{ TokenType::EndOfFile, line_count });
         }
       }
 
-     // Increment line counter for every new line
-      else if (peek().value() == '\n') {
-        pop();
-        line_count++;
-      } 
-
-      // Skip whitespace
-      else if (isspace(peek().value())) {
-        pop();
+      // Names, numbers, strings and comments reaching the end of a partial window may continue
+      // past it. Whitespace has been counted already and is simply skipped.
+      if (m_partial && pos >= m_src.size() && kind != CharClass::Symbol && kind != CharClass::Blank) {
+        pos = start;
+        result = Scan::Incomplete;
+        break;
       }
 
-      // Character must be symbol or invalid
-      else {
-        tokens.emplace_back(Token{ get_symbol(peek().value()), line_count });
-        pop();
+      if (scanned) {
+        break;
       }
     }
 
-    tokens.emplace_back(Token{ TokenType::EndOfFile, line_count });
-    m_idx = 0;
-    return tokens;
+    m_pos = pos;
+    m_line = line_count;
+    return result;
   }
 
-private:
-  [[nodiscard]] std::optional<char> peek(int ahead = 0) const {
-    if (m_idx + ahead >= m_src.length()) {
-      return {};
-    }
-
-    return m_src[m_idx + ahead];
+  // Offset in the text where scanning continues, and the line it is on
+  size_t position() const {
+    return m_pos;
   }
 
-  char pop() {
-    return m_src[m_idx++];
+  int line() const {
+    return m_line;
   }
 
-  TokenType get_keyword(const std::string& token) const {
-    static const std::unordered_map<std::string, TokenType> keywords = {
-      {"let", TokenType::Let},
-      {"const", TokenType::Const},
-      {"fn", TokenType::Fn},
-      {"if", TokenType::If},
-      {"else", TokenType::Else},
-      {"elif", TokenType::Elif},
-      {"for", TokenType::For},
-      {"while", TokenType::While},
-      {"return", TokenType::Return},
-      {"null", TokenType::Null},
-      {"true", TokenType::True},
-      {"false", TokenType::False}
-    };
-
-    auto it = keywords.find(token);
-    return it != keywords.end() ? it->second : TokenType::Identifier;
-  }
+private:
+  enum class CharClass : uint8_t {
+    Invalid,
+    Blank,
+    Letter,
+    Digit,
+    Quote,
+    Comment,
+    Symbol
+  };
+
+  // Token type of each single character symbol, taken from the one character token names
+  static constexpr std::array<TokenType, 256> symbol_types = [] {
+    std::array<TokenType, 256> types{};
+    for (size_t type = static_cast<size_t>(TokenType::OpenPar); type < token_names.size(); ++type) {
+      if (token_names[type].size() == 1) {
+        types[static_cast<uint8_t>(token_names[type][0])] = static_cast<TokenType>(type);
+      }
+    }
 
-  TokenType get_symbol(char token) const {
-    static const std::unordered_map<char, TokenType> symbols = {
-      {'+', TokenType::Plus},
-      {'-', TokenType::Minus},
-      {'*', TokenType::Star},
-      {'/', TokenType::FwdSlash},
-      {'%', TokenType::Modulo},
-      {'=', TokenType::Equals},
-      {'!', TokenType::Not},
-      {'>', TokenType::Greater},
-      {'<', TokenType::Less},
-      {'&', TokenType::And},
-      {'|', TokenType::Or},
-      {'(', TokenType::OpenPar},
-      {')', TokenType::ClosePar},
-      {'{', TokenType::OpenBrace},
-      {'}', TokenType::CloseBrace},
-      {'[', TokenType::OpenBracket},
-      {']', TokenType::CloseBracket},
-      {',', TokenType::Comma},
-      {':', TokenType::Colon},
-      {';', TokenType::Semicol},
-      {'.', TokenType::Dot}
-    };
-        
-    auto it = symbols.find(token);
-    if (it != symbols.end()) {
-      return it->second;
+    return types;
+  }();
+
+  // Class of every byte a token can start with, bytes outside ASCII are invalid
+  static constexpr std::array<CharClass, 256> char_classes = [] {
+    std::array<CharClass, 256> classes{};
+    for (int c = 0; c < 128; ++c) {
+      if (scan::is_blank(c)) {
+        classes[c] = CharClass::Blank;
+      } else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+        classes[c] = CharClass::Letter;
+      } else if (scan::is_digit(c)) {
+        classes[c] = CharClass::Digit;
+      }
     }
-    std::cerr << "Invalid character: " << token << "\n"; 
-    std::exit(EXIT_FAILURE);
+
+    classes['"'] = CharClass::Quote;
+    classes['#'] = CharClass::Comment;
+    for (size_t type = static_cast<size_t>(TokenType::OpenPar); type < token_names.size(); ++type) {
+      if (token_names[type].size() == 1) {
+        classes[static_cast<uint8_t>(token_names[type][0])] = CharClass::Symbol;
+      }
+    }
+
+    return classes;
+  }();
+
+  // Name that stays valid after a streamed window is overwritten
+  std::string_view stable(std::string_view text, Symbol symbol) const {
+    return m_streamed ? m_symbols->name(symbol) : text;
   }
 
-  const std::string m_src;
-  size_t m_idx;
+  std::string_view m_src;
+  // A pointer rather than a reference so a stream can replace its tokenizer for each window
+  Error* m_error;
+  size_t m_pos = 0;
+  int m_line = 1;
+  bool m_streamed = false;
+  bool m_partial = false;
+  SymbolTable* m_symbols = &SymbolTable::global();
 };
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "values/ast.hpp"
+
+#include <array>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <algorithm>
+
+// Execution counters and timing for the tree walking interpreter, per kind of AST node, per
+// source line and for variable lookups. Times are self times, nested nodes and calls are
+// subtracted from the node or line they run inside, so recursion is not counted twice.
+struct TraceStats {
+  struct Counter {
+    size_t count = 0;
+    std::chrono::nanoseconds time{ 0 };
+  };
+
+  // Counts one execution and adds its time until it goes out of scope, less the time of the
+  // timers started inside it on the same chain
+  class Timer {
+  public:
+    Timer(Counter& counter, Timer*& active)
+      : m_counter(counter), m_active(active), m_parent(active), m_start(std::chrono::steady_clock::now())
+    {
+      m_active = this;
+    }
+
+    ~Timer() {
+      std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - m_start;
+      ++m_counter.count;
+      m_counter.time += elapsed - m_nested;
+
+      if (m_parent) {
+        m_parent->m_nested += elapsed;
+      }
+      m_active = m_parent;
+    }
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+  private:
+    Counter& m_counter;
+    Timer*& m_active;
+    Timer* m_parent;
+    std::chrono::steady_clock::time_point m_start;
+    std::chrono::nanoseconds m_nested{ 0 };
+  };
+
+  // Names of the alternatives of Stmt and Expr, in declaration order
+  static constexpr std::array<std::string_view, Stmt::alternatives> stmt_kinds = {
+    "Expr", "VarDeclaration", "VarAssignment", "FunctionDeclaration", "ConditionalBlock", "ForLoop", "WhileLoop"
+  };
+  static constexpr std::array<std::string_view, Expr::alternatives> expr_kinds = {
+    "NullLiteral", "Identifier", "IntLiteral", "FloatLiteral", "StringLiteral", "BoolLiteral",
+    "BinaryExpr", "BoolExpr", "ObjectLiteral", "CallExpr", "MemberExpr", "Increment", "ReturnExpr"
+  };
+
+  std::array<Counter, Stmt::alternatives> stmts{};
+  std::array<Counter, Expr::alternatives> exprs{};
+
+  // Statements started on each line, a map so counters stay in place while nested lines are added
+  std::map<int, Counter> lines;
+
+  // Environment activity
+  Counter lookups;
+  size_t stores = 0;
+  size_t parent_hops = 0;
+  size_t frames_pushed = 0;
+  size_t frames_reused = 0;
+
+  // Calls to pure functions answered from the memo cache
+  size_t memo_hits = 0;
+  size_t memo_misses = 0;
+  size_t memo_evictions = 0;
+
+  // Innermost running timers, lookups are timed on the node chain
+  Timer* active_node = nullptr;
+  Timer* active_line = nullptr;
+
+  void report_table(std::ostream& out) const {
+    out << std::left << std::setw(22) << "node" << std::right << std::setw(14) << "count"
+        << std::setw(14) << "self ms" << std::setw(12) << "avg ns" << "\n";
+    for (size_t idx = 1; idx < stmts.size(); ++idx) {
+      print_row(out, stmt_kinds[idx], stmts[idx]);
+    }
+    for (size_t idx = 0; idx < exprs.size(); ++idx) {
+      print_row(out, expr_kinds[idx], exprs[idx]);
+    }
+
+    // Only the hottest lines, the JSON output has all of them
+    std::vector<std::pair<int, Counter>> hottest(lines.begin(), lines.end());
+    std::sort(hottest.begin(), hottest.end(), [](const auto& lhs, const auto& rhs) {
+      return lhs.second.time > rhs.second.time;
+    });
+    hottest.resize(std::min<size_t>(hottest.size(), 20));
+
+    out << "\n" << std::left << std::setw(22) << "line" << std::right << std::setw(14) << "count"
+        << std::setw(14) << "self ms" << std::setw(12) << "avg ns" << "\n";
+    for (const auto& [line, counter] : hottest) {
+      print_row(out, std::to_string(line), counter);
+    }
+
+    out << "\n";
+    print_row(out, "search_var", lookups);
+    out << std::left << std::setw(22) << "stores" << std::right << std::setw(14) << stores << "\n"
+        << std::left << std::setw(22) << "parent frame hops" << std::right << std::setw(14) << parent_hops << "\n"
+        << std::left << std::setw(22) << "frames pushed" << std::right << std::setw(14) << frames_pushed << "\n"
+        << std::left << std::setw(22) << "frames reused" << std::right << std::setw(14) << frames_reused << "\n"
+        << std::left << std::setw(22) << "memo hits" << std::right << std::setw(14) << memo_hits << "\n"
+        << std::left << std::setw(22) << "memo misses" << std::right << std::setw(14) << memo_misses << "\n"
+        << std::left << std::setw(22) << "memo evictions" << std::right << std::setw(14) << memo_evictions << "\n";
+  }
+
+  void report_json(std::ostream& out) const {
+    out << "{\n  \"nodes\": {";
+    bool first = true;
+    for (size_t idx = 1; idx < stmts.size(); ++idx) {
+      print_entry(out, stmt_kinds[idx], stmts[idx], first);
+    }
+    for (size_t idx = 0; idx < exprs.size(); ++idx) {
+      print_entry(out, expr_kinds[idx], exprs[idx], first);
+    }
+
+    out << "\n  },\n  \"lines\": {";
+    first = true;
+    for (const auto& [line, counter] : lines) {
+      print_entry(out, std::to_string(line), counter, first);
+    }
+
+    out << "\n  },\n  \"environment\": {\n"
+        << "    \"search_var\": { \"count\": " << lookups.count << ", \"ns\": " << lookups.time.count() << " },\n"
+        << "    \"stores\": " << stores << ",\n"
+        << "    \"parent_hops\": " << parent_hops << ",\n"
+        << "    \"frames_pushed\": " << frames_pushed << ",\n"
+        << "    \"frames_reused\": " << frames_reused << "\n  },\n  \"memo\": {\n"
+        << "    \"hits\": " << memo_hits << ",\n"
+        << "    \"misses\": " << memo_misses << ",\n"
+        << "    \"evictions\": " << memo_evictions << "\n  }\n}\n";
+  }
+
+private:
+  static void print_row(std::ostream& out, std::string_view name, const Counter& counter) {
+    if (counter.count == 0) {
+      return;
+    }
+
+    out << std::left << std::setw(22) << name << std::right << std::setw(14) << counter.count
+        << std::setw(14) << std::fixed << std::setprecision(3) << counter.time.count() / 1e6
+        << std::setw(12) << counter.time.count() / counter.count << "\n";
+  }
+
+  static void print_entry(std::ostream& out, std::string_view name, const Counter& counter, bool& first) {
+    if (counter.count == 0) {
+      return;
+    }
+
+    out << (first ? "\n" : ",\n") << "    \"" << name << "\": { \"count\": " << counter.count
+        << ", \"ns\": " << counter.time.count() << " }";
+    first = false;
+  }
+};
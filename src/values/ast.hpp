@@ -1,79 +1,179 @@
 #pragma once
 
 #include "tokens.hpp"
+#include "shape.hpp"
+#include "inline_cache.hpp"
+#include "../arena.hpp"
+
+// Only the memo statistics each function declaration holds, the cache itself needs this header
+#define MEMO_STATS_ONLY
+#include "../memo_cache.hpp"
+#undef MEMO_STATS_ONLY
 
 #include <vector>
+#include <span>
+#include <cstdio>
 #include <functional>
 #include <memory>
-#include <any>
-#include <typeindex>
+#include <variant>
+#include <cstdint>
+#include <type_traits>
+
+// Immutable storage for recursive node types, allocated in the current Arena so copying a tree
+// only copies pointers. Nodes stay at the same address until their arena is freed.
+template<typename T>
+class Box {
+public:
+  Box(T value) : m_ptr(Arena::current().make<T>(std::move(value))) {}
+
+  const T& operator*() const {
+    return *m_ptr;
+  }
+
+  const T* operator->() const {
+    return m_ptr;
+  }
+
+private:
+  const T* m_ptr;
+};
+
+// Reference counted storage for runtime values that can outlive the code that created them
+template<typename T>
+class Shared {
+public:
+  Shared(T value) : m_ptr(std::make_shared<const T>(std::move(value))) {}
+
+  const T& operator*() const {
+    return *m_ptr;
+  }
+
+  const T* operator->() const {
+    return m_ptr.get();
+  }
+
+private:
+  std::shared_ptr<const T> m_ptr;
+};
+
+// Node types that are stored in a Box rather than inline
+template<typename T>
+struct is_boxed : std::false_type {};
+
+// Runtime types that are stored in a Shared rather than inline
+template<typename T>
+struct is_shared : std::false_type {};
+
+template<typename T>
+using node_storage = std::conditional_t<is_boxed<T>::value, Box<T>,
+    std::conditional_t<is_shared<T>::value, Shared<T>, T>>;
 
-// Class representing a node in an abstract syntax tree
+// Helper for building a visitor out of lambdas
+template<typename... Fs>
+struct overloaded : Fs... {
+  using Fs::operator()...;
+};
+
+template<typename... Fs>
+overloaded(Fs...) -> overloaded<Fs...>;
+
+// Class representing a node in an abstract syntax tree as a closed set of alternatives
+template<typename... Ts>
 class ASTNode {
 protected:
-  std::any var;
+  std::variant<node_storage<Ts>...> var;
 
 public:
   ASTNode() = default;
 
   template<typename T>
-  ASTNode(T value) : var(value) {}
-
-  // Get the stored value as a mutable reference or constant reference
-  template<typename T>
-  T& get() {
-    return std::any_cast<T&>(var);
-  }
+  ASTNode(T value) : var(node_storage<T>(std::move(value))) {}
 
+  // Get the stored value as a constant reference
   template<typename T>
   const T& get() const {
-    return std::any_cast<const T&>(var);
-  }
-
-  // Get a pointer to the stored value if it matches the requested type
-  template<typename T>
-  T* get_if() {
-    if (is<T>()) {
-      return std::any_cast<T>(&var);
+    if constexpr (is_boxed<T>::value || is_shared<T>::value) {
+      return *std::get<node_storage<T>>(var);
+    } else {
+      return std::get<T>(var);
     }
-    return nullptr;
   }
 
+  // Get a pointer to the stored value if it matches the requested type
   template<typename T>
   const T* get_if() const {
-    if (is<T>()) {
-      return std::any_cast<const T>(&var);
+    if constexpr (is_boxed<T>::value || is_shared<T>::value) {
+      auto box = std::get_if<node_storage<T>>(&var);
+      return box ? &**box : nullptr;
+    } else {
+      return std::get_if<T>(&var);
     }
-    return nullptr;
   }
 
-  // Get the type information
-  const std::type_info& type() const {
-    return var.type();
+  // Get a mutable pointer to a value stored inline, so it can be updated in place
+  template<typename T>
+  T* get_if() requires (!is_boxed<T>::value && !is_shared<T>::value) {
+    return std::get_if<T>(&var);
   }
 
   // Check if the stored value is of the requested type
   template<typename T>
   bool is() const {
-    return var.type() == typeid(T);
+    return std::holds_alternative<node_storage<T>>(var);
+  }
+
+  // Position of the stored type in the list of alternatives
+  size_t index() const {
+    return var.index();
+  }
+
+  static constexpr size_t alternatives = sizeof...(Ts);
+
+  // Call the visitor with the stored value, unwrapping boxed nodes
+  template<typename Visitor>
+  decltype(auto) visit(Visitor&& visitor) const {
+    return std::visit([&visitor](const auto& value) -> decltype(auto) {
+      if constexpr (requires { *value; }) {
+        return visitor(*value);
+      } else {
+        return visitor(value);
+      }
+    }, var);
   }
 };
 
 // Literal Types
 struct Identifier {
   Token token;
+
+  // Location assigned by the Resolver, the number of frames to walk up and the slot within that frame
+  uint16_t depth = 0;
+  uint16_t slot = 0;
 };
 
 struct IntLiteral {
   Token token;
+  int64_t value = 0;
 };
 
 struct FloatLiteral {
   Token token;
+  double value = 0.0;
+  // Digits after the point it prints with when it has no text, as many as a streamed literal
+  // that dropped its text was written with
+  int decimals = 6;
+
+  static std::string format(double value, int decimals) {
+    std::string text(std::snprintf(nullptr, 0, "%.*f", decimals, value), '\0');
+    std::snprintf(text.data(), text.size() + 1, "%.*f", decimals, value);
+    return text;
+  }
 };
 
 struct StringLiteral {
   Token token;
+  // Strings built at runtime own their text, literals view the source
+  std::shared_ptr<const std::string> owned;
 };
 
 struct BoolLiteral {
@@ -83,17 +183,56 @@ struct BoolLiteral {
 
 struct NullLiteral {};
 
+// Recursive node types
+struct BinaryExpr;
+struct BoolExpr;
+struct ObjectLiteral;
+struct CallExpr;
+struct MemberExpr;
+struct ReturnExpr;
+struct VarDeclaration;
+struct VarAssignment;
+struct FunctionDeclaration;
+struct ConditionalBlock;
+struct ForLoop;
+struct WhileLoop;
+struct Function;
+
+template<> struct is_boxed<BinaryExpr> : std::true_type {};
+template<> struct is_boxed<BoolExpr> : std::true_type {};
+template<> struct is_boxed<ObjectLiteral> : std::true_type {};
+template<> struct is_boxed<CallExpr> : std::true_type {};
+template<> struct is_boxed<MemberExpr> : std::true_type {};
+template<> struct is_boxed<ReturnExpr> : std::true_type {};
+template<> struct is_boxed<VarDeclaration> : std::true_type {};
+template<> struct is_boxed<VarAssignment> : std::true_type {};
+template<> struct is_boxed<FunctionDeclaration> : std::true_type {};
+template<> struct is_boxed<ConditionalBlock> : std::true_type {};
+template<> struct is_boxed<ForLoop> : std::true_type {};
+template<> struct is_boxed<WhileLoop> : std::true_type {};
+template<> struct is_shared<Function> : std::true_type {};
+
+struct Increment {
+  Identifier identifier;
+  Token operand;
+};
+
 // Program structure
-struct Expr : public ASTNode {
+struct Expr : public ASTNode<NullLiteral, Identifier, IntLiteral, FloatLiteral, StringLiteral, BoolLiteral,
+    BinaryExpr, BoolExpr, ObjectLiteral, CallExpr, MemberExpr, Increment, ReturnExpr> {
   using ASTNode::ASTNode;
 };
 
-struct Stmt : public ASTNode {
+struct Stmt : public ASTNode<Expr, VarDeclaration, VarAssignment, FunctionDeclaration, 
+    ConditionalBlock, ForLoop, WhileLoop> {
   using ASTNode::ASTNode;
 };
 
+// The arena owns every node in the program, freeing the program frees the whole tree at once
 struct Program {
   std::vector<Stmt> stmts;
+  size_t slot_count = 0;
+  std::shared_ptr<Arena> arena;
 };
 
 // Declarations
@@ -112,12 +251,10 @@ struct FunctionDeclaration {
   Identifier name;
   std::vector<Identifier> params;
   std::vector<Stmt> body;
-};
-
-class Environment;
-struct Function {
-  FunctionDeclaration declaration;
-  std::shared_ptr<Environment> env;
+  size_t slot_count = 0;
+  // Set by the Optimizer when the result only depends on the arguments, so it can be memoized
+  bool pure = false;
+  mutable MemoStats memo;
 };
 
 // Object Literal
@@ -143,19 +280,17 @@ struct BoolExpr {
   Token operand;
 };
 
-struct Increment {
-  Identifier identifier;
-  Token operand;
-};
-
 struct CallExpr {
   std::vector<Stmt> args;
   Expr caller;
+  mutable CallCache cache;
 };
 
+// The cache belongs to the first key looked up in member, so each level of a chain has its own
 struct MemberExpr {
   Identifier object;
   Expr member;
+  mutable PropertyCache cache;
 };
 
 struct ReturnExpr {
@@ -184,28 +319,83 @@ struct ForLoop {
   BoolExpr condition;
   Expr counter;
   std::vector<Stmt> body;
+  bool declares_variable = false;
 };
 
 // Runtime
-struct RuntimeVal : public ASTNode {
+struct RuntimeVal;
+struct NativeFunction {
+  using Call = std::function<RuntimeVal(std::span<const RuntimeVal>)>;
+  Call call;
+};
+
+struct Chunk;
+struct Frame;
+struct Function {
+  // Owned by the program's arena
+  const FunctionDeclaration* declaration;
+  std::shared_ptr<Frame> env;
+  std::shared_ptr<const Chunk> chunk;
+};
+
+struct Object;
+template<> struct is_shared<Object> : std::true_type {};
+
+struct RuntimeVal : public ASTNode<NullLiteral, IntLiteral, FloatLiteral, StringLiteral, BoolLiteral, 
+    Object, NativeFunction, Function> {
   using ASTNode::ASTNode;
 
   // Function to get the token held within the value
   Token get_token() const {
-    static const std::unordered_map<std::type_index, std::function<Token(const ASTNode&)>> tokens {
-      { typeid(IntLiteral), [](const ASTNode& node) { return node.get<IntLiteral>().token; } },
-      { typeid(FloatLiteral), [](const ASTNode& node) { return node.get<FloatLiteral>().token; } },
-      { typeid(StringLiteral), [](const ASTNode& node) { return node.get<StringLiteral>().token; } },
-      { typeid(BoolLiteral), [](const ASTNode& node) { return node.get<BoolLiteral>().token; } },
-      { typeid(Identifier), [](const ASTNode& node) { return node.get<Identifier>().token; } }
-    };
-
-    auto it = tokens.find(var.type());
-    return it->second(var);
+    return visit(overloaded {
+      [](const IntLiteral& literal) { return literal.token; },
+      [](const FloatLiteral& literal) { return literal.token; },
+      [](const StringLiteral& literal) { return literal.token; },
+      [](const BoolLiteral& literal) { return literal.token; },
+      [](const auto&) { return Token{ TokenType::Null, 0 }; }
+    });
+  }
+
+  // Function to get the text representation of the value, formatting numbers on demand
+  std::string to_string() const {
+    if (auto integer = get_if<IntLiteral>()) {
+      return integer->token.raw_value.has_value() 
+        ? integer->token.text() 
+        : std::to_string(integer->value);
+    }
+    if (auto floating = get_if<FloatLiteral>()) {
+      return floating->token.raw_value.has_value()
+        ? floating->token.text()
+        : FloatLiteral::format(floating->value, floating->decimals);
+    }
+    if (auto boolean = get_if<BoolLiteral>()) {
+      return boolean->value ? "true" : "false";
+    }
+
+    return get_token().text();
   }
 };
 
-struct NativeFunction {
-  using Call = std::function<RuntimeVal(const std::vector<RuntimeVal>)>;
-  Call call;
+// Object value built from an object literal. The shape maps each key to its slot in values.
+// Objects are shared between every variable that holds them rather than copied.
+struct Object {
+  const Shape* shape = Shape::root();
+  std::vector<RuntimeVal> values;
+
+  const RuntimeVal* find(Symbol key) const {
+    uint32_t slot = shape->find(key);
+    return slot == Shape::not_found ? nullptr : &values[slot];
+  }
+
+  // Add a property, or replace it if the key is repeated, while the object is being built
+  void set(Symbol key, RuntimeVal value) {
+    uint32_t slot = shape->find(key);
+    if (slot != Shape::not_found) {
+      values[slot] = std::move(value);
+      return;
+    }
+
+    shape = shape->with(key);
+    values.emplace_back(std::move(value));
+  }
 };
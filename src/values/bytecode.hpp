@@ -0,0 +1,85 @@
+#pragma once
+
+#include "ast.hpp"
+
+#include <cstdint>
+
+// Instructions understood by the VM. Operands follow the opcode as 16 bit values.
+enum class OpCode : uint8_t {
+  // Values
+  Constant,       // [constant]        push a value from the constant pool
+  Null,           //                   push null
+  Pop,            //                   discard the top of the stack
+
+  // Variables, names carry the frame depth and slot assigned by the Resolver
+  Load,           // [name]            push the value of a variable
+  Store,          // [name]            pop a value into a variable
+  DeclareEmpty,   // [name]            declare a variable without a value
+  Increment,      // [name]            add one to a variable and push the result
+  Decrement,      // [name]            subtract one from a variable and push the result
+
+  // Arithmetic
+  Add,
+  Subtract,
+  Multiply,
+  Divide,
+  Modulo,
+
+  // Comparison and logic, each pushes a boolean
+  Equal,
+  NotEqual,
+  Greater,
+  Less,
+  GreaterEqual,
+  LessEqual,
+  And,
+  Or,
+
+  // Control flow
+  Jump,           // [offset]          jump forward
+  JumpIfFalse,    // [offset]          pop a boolean and jump forward if it is false
+  Loop,           // [offset]          jump backward
+
+  // Counted for loops, the counter is tested and stepped in place while it holds an integer
+  ForCheck,       // [name] [bound] [compare] [offset] jump forward unless the counter passes the compare
+  ForStep,        // [name] [step]     add the signed step to the counter
+
+  // Objects and functions
+  MakeObject,     // [layout]          pop one value per property and push an Object
+  GetMember,      // [name] [cache]    replace an Object with one of its members
+  MakeFunction,   // [function]        declare a function closing over the current frame
+  Call,           // [name] [argc] [cache] call a function with the arguments on the stack
+  TailCall,       // [name] [argc] [cache] call in tail position, replacing the current frame
+  Return,         //                   pop the return value and leave the current function
+  Continue        //                   run the next part of a program body split across chunks
+};
+
+struct Chunk;
+
+// Shape of the object built by an object literal and the slot each property value is stored in
+struct ObjectLayout {
+  const Shape* shape;
+  std::vector<uint32_t> slots;
+};
+
+struct CompiledFunction {
+  const FunctionDeclaration* declaration;
+  std::shared_ptr<const Chunk> chunk;
+};
+
+// Flat bytecode for a program or function body along with the tables its operands index
+struct Chunk {
+  std::vector<uint8_t> code;
+  std::vector<int> lines;
+  std::vector<RuntimeVal> constants;
+  std::vector<Identifier> names;
+  std::vector<ObjectLayout> object_layouts;
+  std::vector<CompiledFunction> functions;
+
+  // Inline caches for member access and call sites, updated as the chunk runs
+  mutable std::vector<PropertyCache> property_caches;
+  mutable std::vector<CallCache> call_caches;
+
+  // The rest of a program body too large for one chunk's operands
+  std::shared_ptr<const Chunk> next;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "shape.hpp"
+
+#include <array>
+
+struct FunctionDeclaration;
+
+// Per-site cache of where a property was found for the last few object shapes seen there.
+// Sites that only ever see one shape hit the first entry, up to four shapes are remembered.
+struct PropertyCache {
+  static constexpr size_t ways = 4;
+
+  std::array<const Shape*, ways> shapes{};
+  std::array<uint32_t, ways> slots{};
+  uint8_t next = 0;
+
+  uint32_t lookup(const Shape* shape, Symbol key) {
+    for (size_t idx = 0; idx < ways; ++idx) {
+      if (shapes[idx] == shape) {
+        return slots[idx];
+      }
+    }
+
+    // Miss, do the full lookup and replace the oldest entry
+    uint32_t slot = shape->find(key);
+    if (slot != Shape::not_found) {
+      shapes[next] = shape;
+      slots[next] = slot;
+      next = (next + 1) % ways;
+    }
+
+    return slot;
+  }
+};
+
+// Per-site cache of the last function called there, whose argument count was already checked.
+// Variables are bound to slots before execution, so the callee itself is found without a search.
+struct CallCache {
+  const FunctionDeclaration* declaration = nullptr;
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "symbols.hpp"
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+// Hidden class describing the layout of an Object: which key is stored in which value slot.
+// Objects built with the same keys in the same order share one Shape, reached from the root
+// through a tree of transitions that add one key at a time. Shapes are never freed.
+class Shape {
+public:
+  static constexpr uint32_t not_found = UINT32_MAX;
+
+  static const Shape* root() {
+    static const Shape root_shape(nullptr, SymbolTable::empty);
+    return &root_shape;
+  }
+
+  // Shape with the key appended, shared by every object that adds the same key to this shape
+  const Shape* with(Symbol key) const {
+    auto it = m_transitions.find(key);
+    if (it != m_transitions.end()) {
+      return it->second.get();
+    }
+
+    auto child = std::unique_ptr<Shape>(new Shape(this, key));
+    return m_transitions.emplace(key, std::move(child)).first->second.get();
+  }
+
+  // Slot the key is stored in, found with an open addressing lookup
+  uint32_t find(Symbol key) const {
+    if (m_table.empty()) {
+      return not_found;
+    }
+
+    size_t mask = m_table.size() - 1;
+    for (size_t idx = hash(key) & mask; ; idx = (idx + 1) & mask) {
+      const Entry& entry = m_table[idx];
+      if (entry.key == key) {
+        return entry.slot;
+      }
+      if (entry.key == SymbolTable::empty) {
+        return not_found;
+      }
+    }
+  }
+
+  size_t size() const {
+    return m_keys.size();
+  }
+
+  Symbol key(size_t slot) const {
+    return m_keys[slot];
+  }
+
+private:
+  struct Entry {
+    Symbol key = SymbolTable::empty;
+    uint32_t slot = 0;
+  };
+
+  Shape(const Shape* parent, Symbol key) {
+    if (parent) {
+      m_keys = parent->m_keys;
+      m_keys.emplace_back(key);
+    }
+
+    // Keep the table at most half full so probes stay short
+    size_t capacity = 1;
+    while (capacity < m_keys.size() * 2) {
+      capacity *= 2;
+    }
+
+    if (!m_keys.empty()) {
+      m_table.resize(capacity);
+      size_t mask = capacity - 1;
+
+      for (uint32_t slot = 0; slot < m_keys.size(); ++slot) {
+        size_t idx = hash(m_keys[slot]) & mask;
+        while (m_table[idx].key != SymbolTable::empty) {
+          idx = (idx + 1) & mask;
+        }
+
+        m_table[idx] = Entry{ m_keys[slot], slot };
+      }
+    }
+  }
+
+  static size_t hash(Symbol key) {
+    return static_cast<size_t>(key) * 0x9E3779B97F4A7C15ull >> 32;
+  }
+
+private:
+  std::vector<Symbol> m_keys;
+  std::vector<Entry> m_table;
+  mutable std::unordered_map<Symbol, std::unique_ptr<Shape>> m_transitions;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Interned id of an identifier or string literal, equal text always has the same id
+using Symbol = uint32_t;
+
+// Global table that interns names once during tokenization so later stages compare integers
+class SymbolTable {
+public:
+  // The empty string is always symbol 0, so tokens without text can use it
+  static constexpr Symbol empty = 0;
+
+  // Tables other than the global one are only used while tokenizing in parallel, their symbols
+  // are then mapped onto the global table
+  SymbolTable() {
+    intern("");
+  }
+
+  static SymbolTable& global() {
+    static SymbolTable table;
+    return table;
+  }
+
+  Symbol intern(std::string_view text) {
+    auto it = m_ids.find(text);
+    if (it != m_ids.end()) {
+      return it->second;
+    }
+
+    // Keep a stable copy of the text so views into it outlive the source it came from
+    const std::string& stored = m_names.emplace_back(text);
+    Symbol symbol = static_cast<Symbol>(m_names.size() - 1);
+    m_ids.emplace(stored, symbol);
+    return symbol;
+  }
+
+  std::string_view name(Symbol symbol) const {
+    return m_names[symbol];
+  }
+
+  size_t size() const {
+    return m_names.size();
+  }
+
+private:
+  std::deque<std::string> m_names;
+  std::unordered_map<std::string_view, Symbol> m_ids;
+};
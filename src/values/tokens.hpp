@@ -1,7 +1,11 @@
 #pragma once
 
+#include "symbols.hpp"
+
+#include <array>
 #include <optional>
 #include <string>
+#include <string_view>
 
 enum class TokenType { 
   // Literal Types
@@ -53,9 +57,71 @@ enum class TokenType {
   EndOfFile
 };
 
+// Text of every token type in declaration order, keywords are spelled as in the source
+inline constexpr std::array<std::string_view, static_cast<size_t>(TokenType::EndOfFile) + 1> token_names = {
+  "Integer Literal", "Float Literal", "Identifier", "null", "true", "false", "String Literal",
+  "let", "const", "fn", "if", "else", "elif", "for", "while", "return",
+  "(", ")", "{", "}", "[", "]",
+  "+", "-", "*", "/", "%", "=", "!", ">", ">=", "<", "<=", "&", "|", ",", ":", ";", ".", "eof"
+};
+
+// Keywords looked up with a perfect hash of their length and first and last characters, so
+// classifying a word costs one table load and one compare
+namespace keywords {
+  inline constexpr std::array<TokenType, 12> all = {
+    TokenType::Let, TokenType::Const, TokenType::Fn, TokenType::If, TokenType::Else, TokenType::Elif,
+    TokenType::For, TokenType::While, TokenType::Return, TokenType::Null, TokenType::True, TokenType::False
+  };
+
+  constexpr size_t hash(std::string_view word) {
+    return (word.size() + static_cast<uint8_t>(word.front()) + static_cast<uint8_t>(word.back())) & 31;
+  }
+
+  // Empty slots hold Identifier, whose name never matches a word that hashes there
+  inline constexpr std::array<TokenType, 32> table = [] {
+    std::array<TokenType, 32> slots{};
+    slots.fill(TokenType::Identifier);
+    for (TokenType type : all) {
+      slots[hash(token_names[static_cast<size_t>(type)])] = type;
+    }
+
+    return slots;
+  }();
+
+  // Keyword type of word, or Identifier
+  constexpr TokenType find(std::string_view word) {
+    if (word.size() < 2 || word.size() > 6) {
+      return TokenType::Identifier;
+    }
+
+    TokenType type = table[hash(word)];
+    return token_names[static_cast<size_t>(type)] == word ? type : TokenType::Identifier;
+  }
+
+  constexpr bool collision_free() {
+    for (TokenType type : all) {
+      if (find(token_names[static_cast<size_t>(type)]) != type) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  static_assert(collision_free(), "Keyword hash collision, change the hash");
+}
+
+// Tokens refer to their text in the source buffer, which outlives every stage of the pipeline
 struct Token {
   TokenType type;
   int line;
-  std::optional<std::string> raw_value;
+  std::optional<std::string_view> raw_value;
+  // Interned id of identifier and string text, names are compared by this instead of their text
+  Symbol symbol = SymbolTable::empty;
+
+  // Copy of the raw text for building messages
+  std::string text() const {
+    return std::string(raw_value.value_or(""));
+  }
 };
 
@@ -0,0 +1,397 @@
+#pragma once
+
+#include "environment.hpp"
+#include "memo_cache.hpp"
+#include "operators.hpp"
+#include "profiler.hpp"
+#include "values/bytecode.hpp"
+
+// Stack based virtual machine that executes compiled bytecode
+class VM {
+public:
+  explicit VM(std::shared_ptr<const Chunk> chunk, Error& error, Environment env)
+    : m_error(error), m_env(std::move(env)), m_operators(m_error)
+  {
+    // Call frames are kept in one vector whose storage is reused as calls return
+    m_frames.reserve(64);
+    m_frames.emplace_back(CallFrame{ std::move(chunk), 0, nullptr, 0, SymbolTable::empty });
+  }
+
+  void set_max_call_depth(size_t depth) {
+    m_max_call_depth = depth;
+  }
+
+  // Look calls to pure functions up in the cache and store their results
+  void set_memo(MemoCache* memo) {
+    m_memo = memo;
+  }
+
+  // Sample the call stack whenever the profiler's timer has fired
+  void set_profiler(Profiler* profiler) {
+    m_profiler = profiler;
+  }
+
+  RuntimeVal run() {
+    CallFrame* frame = &m_frames.back();
+    const Chunk* chunk = frame->chunk.get();
+    const uint8_t* code = chunk->code.data();
+    size_t ip = frame->ip;
+
+    auto read_u16 = [&]() -> uint16_t {
+      uint16_t value = (code[ip] << 8) | code[ip + 1];
+      ip += 2;
+      return value;
+    };
+
+    while (true) {
+      size_t offset = ip;
+      if (m_profiler && Profiler::pending()) {
+        sample(chunk->lines[offset]);
+      }
+
+      OpCode op = static_cast<OpCode>(code[ip++]);
+
+      switch (op) {
+        case OpCode::Constant: {
+          push(chunk->constants[read_u16()]);
+          break;
+        }
+        case OpCode::Null: {
+          push(NullLiteral());
+          break;
+        }
+        case OpCode::Pop: {
+          m_stack.pop_back();
+          break;
+        }
+        case OpCode::Load: {
+          push(m_env.search_var(chunk->names[read_u16()]));
+          break;
+        }
+        case OpCode::Store: {
+          m_env.assign_var(chunk->names[read_u16()], pop());
+          break;
+        }
+        case OpCode::DeclareEmpty: {
+          m_env.declare_var(chunk->names[read_u16()], std::nullopt);
+          break;
+        }
+        case OpCode::Increment:
+        case OpCode::Decrement: {
+          const Identifier& name = chunk->names[read_u16()];
+          Token operand{ op == OpCode::Increment ? TokenType::Plus : TokenType::Minus, chunk->lines[offset] };
+          IntLiteral one_literal{ Token{ TokenType::Int, 0 }, 1 };
+
+          RuntimeVal value = m_operators.eval_binary(m_env.search_var(name), one_literal, operand);
+          m_env.assign_var(name, value);
+          push(std::move(value));
+          break;
+        }
+        case OpCode::Add:
+          binary(TokenType::Plus, chunk->lines[offset]);
+          break;
+        case OpCode::Subtract:
+          binary(TokenType::Minus, chunk->lines[offset]);
+          break;
+        case OpCode::Multiply:
+          binary(TokenType::Star, chunk->lines[offset]);
+          break;
+        case OpCode::Divide:
+          binary(TokenType::FwdSlash, chunk->lines[offset]);
+          break;
+        case OpCode::Modulo:
+          binary(TokenType::Modulo, chunk->lines[offset]);
+          break;
+        case OpCode::Equal:
+          boolean(TokenType::Equals, chunk->lines[offset]);
+          break;
+        case OpCode::NotEqual:
+          boolean(TokenType::Not, chunk->lines[offset]);
+          break;
+        case OpCode::Greater:
+          boolean(TokenType::Greater, chunk->lines[offset]);
+          break;
+        case OpCode::Less:
+          boolean(TokenType::Less, chunk->lines[offset]);
+          break;
+        case OpCode::GreaterEqual:
+          boolean(TokenType::GreaterEquals, chunk->lines[offset]);
+          break;
+        case OpCode::LessEqual:
+          boolean(TokenType::LessEquals, chunk->lines[offset]);
+          break;
+        case OpCode::And:
+          boolean(TokenType::And, chunk->lines[offset]);
+          break;
+        case OpCode::Or:
+          boolean(TokenType::Or, chunk->lines[offset]);
+          break;
+        case OpCode::Jump: {
+          uint16_t jump = read_u16();
+          ip += jump;
+          break;
+        }
+        case OpCode::JumpIfFalse: {
+          uint16_t jump = read_u16();
+          if (!pop().get<BoolLiteral>().value) {
+            ip += jump;
+          }
+          break;
+        }
+        case OpCode::Loop: {
+          uint16_t jump = read_u16();
+          ip -= jump;
+          break;
+        }
+        case OpCode::ForCheck: {
+          const Identifier& name = chunk->names[read_u16()];
+          int64_t bound = chunk->constants[read_u16()].get<IntLiteral>().value;
+          TokenType compare = static_cast<TokenType>(read_u16());
+          uint16_t jump = read_u16();
+
+          std::optional<RuntimeVal>& slot = m_env.resolve_slot(name);
+          const IntLiteral* counter = slot.has_value() ? slot->get_if<IntLiteral>() : nullptr;
+
+          bool running = counter
+            ? Operators::compare_int(counter->value, bound, compare)
+            : m_operators.eval_boolean(m_env.search_var(name), IntLiteral{ Token{ TokenType::Int, 0 }, bound },
+                Token{ compare, chunk->lines[offset] });
+
+          if (!running) {
+            ip += jump;
+          }
+          break;
+        }
+        case OpCode::ForStep: {
+          const Identifier& name = chunk->names[read_u16()];
+          int64_t step = static_cast<int16_t>(read_u16());
+
+          std::optional<RuntimeVal>& slot = m_env.resolve_slot(name);
+          IntLiteral* counter = slot.has_value() ? slot->get_if<IntLiteral>() : nullptr;
+
+          if (counter) {
+            counter->value += step;
+            counter->token.raw_value.reset();
+          } else {
+            Token operand{ step > 0 ? TokenType::Plus : TokenType::Minus, chunk->lines[offset] };
+            IntLiteral one_literal{ Token{ TokenType::Int, 0 }, 1 };
+            m_env.assign_var(name, m_operators.eval_binary(m_env.search_var(name), one_literal, operand));
+          }
+          break;
+        }
+        case OpCode::MakeObject: {
+          const ObjectLayout& layout = chunk->object_layouts[read_u16()];
+          Object object{ layout.shape, {} };
+          object.values.resize(layout.shape->size());
+
+          // Repeated keys store into the same slot, so the last value wins
+          size_t first = m_stack.size() - layout.slots.size();
+          for (size_t idx = 0; idx < layout.slots.size(); ++idx) {
+            object.values[layout.slots[idx]] = std::move(m_stack[first + idx]);
+          }
+          m_stack.resize(first);
+
+          push(std::move(object));
+          break;
+        }
+        case OpCode::GetMember: {
+          const Identifier& key = chunk->names[read_u16()];
+          PropertyCache& cache = chunk->property_caches[read_u16()];
+          push(m_operators.get_member(pop(), key, cache));
+          break;
+        }
+        case OpCode::MakeFunction: {
+          const CompiledFunction& compiled = chunk->functions[read_u16()];
+
+          Function function{ compiled.declaration, m_env.frame(), compiled.chunk };
+          m_env.declare_var(compiled.declaration->name, function);
+          break;
+        }
+        case OpCode::Call:
+        case OpCode::TailCall: {
+          const Identifier& caller = chunk->names[read_u16()];
+          uint16_t arg_count = read_u16();
+          CallCache& cache = chunk->call_caches[read_u16()];
+          RuntimeVal callee = m_env.search_var(caller);
+          size_t args_base = m_stack.size() - arg_count;
+
+          // Call native functions directly and push the result
+          auto native_fn = callee.get_if<NativeFunction>();
+          if (native_fn) {
+            RuntimeVal result = native_fn->call(std::span<const RuntimeVal>(m_stack).subspan(args_base));
+            m_stack.resize(args_base);
+            push(std::move(result));
+            break;
+          }
+
+          auto function = callee.get_if<Function>();
+          if (!function) {
+            m_error.report_error("Function `" + caller.token.text() +
+                "` not declared in scope.", caller.token);
+          }
+
+          const FunctionDeclaration& function_dec = *function->declaration;
+
+          // The argument count only needs checking when a new function is called from this site
+          if (cache.declaration != &function_dec) {
+            if (arg_count != function_dec.params.size()) {
+              m_error.report_error("Number of arguments does not match function declaration.\n"
+                  "Expected " + std::to_string(function_dec.params.size()) + " arguments for function: " +
+                  caller.token.text(), caller.token);
+            }
+
+            cache.declaration = &function_dec;
+          }
+
+          // A pure function called with the same arguments before returns the same result
+          const FunctionDeclaration* memoized = nullptr;
+          std::span<const RuntimeVal> args(m_stack.data() + args_base, arg_count);
+          if (m_memo && MemoCache::applies(function_dec, args)) {
+            if (const RuntimeVal* cached = m_memo->find(&function_dec, args)) {
+              RuntimeVal result = *cached;
+              m_stack.resize(args_base);
+              push(std::move(result));
+              break;
+            }
+
+            memoized = &function_dec;
+          }
+
+          // A call in tail position leaves the current function first and takes over its frame,
+          // so tail recursion runs in constant space. The program body has no frame to replace.
+          if (op == OpCode::TailCall && m_frames.size() > 1) {
+            m_env.pop_frame(std::move(frame->caller_frame));
+            frame->caller_frame = m_env.push_frame(function->env, function_dec.slot_count);
+            for (size_t idx = 0; idx < arg_count; ++idx) {
+              m_env.declare_var(function_dec.params[idx], std::move(m_stack[args_base + idx]));
+            }
+            m_stack.resize(frame->stack_base);
+
+            frame->chunk = function->chunk;
+            frame->function = function_dec.name.token.symbol;
+            chunk = frame->chunk.get();
+            code = chunk->code.data();
+            ip = 0;
+            break;
+          }
+
+          // The program body is the first frame and does not count as a call
+          if (m_frames.size() > m_max_call_depth) {
+            m_error.report_error("Stack overflow, more than " + std::to_string(m_max_call_depth) +
+                " nested calls when calling: " + caller.token.text(), caller.token);
+          }
+
+          // Enter a frame for the call and move the arguments into the param slots. A memoized
+          // call leaves its arguments on the stack below the frame to store its result under.
+          std::shared_ptr<Frame> caller_frame = m_env.push_frame(function->env, function_dec.slot_count);
+          for (size_t idx = 0; idx < arg_count; ++idx) {
+            RuntimeVal& arg = m_stack[args_base + idx];
+            m_env.declare_var(function_dec.params[idx], memoized ? arg : std::move(arg));
+          }
+          if (!memoized) {
+            m_stack.resize(args_base);
+          }
+
+          // Save the caller position and switch to the function's code
+          frame->ip = ip;
+          m_frames.emplace_back(CallFrame{ function->chunk, 0, std::move(caller_frame), m_stack.size(),
+              function_dec.name.token.symbol, memoized });
+
+          frame = &m_frames.back();
+          chunk = frame->chunk.get();
+          code = chunk->code.data();
+          ip = 0;
+          break;
+        }
+        case OpCode::Return: {
+          RuntimeVal value = pop();
+          m_stack.resize(frame->stack_base);
+
+          if (frame->memoized) {
+            size_t arg_count = frame->memoized->params.size();
+            m_memo->insert(frame->memoized, std::span<const RuntimeVal>(m_stack.data() + frame->stack_base - arg_count, arg_count), value);
+            m_stack.resize(frame->stack_base - arg_count);
+          }
+
+          // Returning from the outermost frame ends the program
+          if (m_frames.size() == 1) {
+            return value;
+          }
+
+          m_env.pop_frame(std::move(frame->caller_frame));
+          m_frames.pop_back();
+          frame = &m_frames.back();
+          chunk = frame->chunk.get();
+          code = chunk->code.data();
+          ip = frame->ip;
+
+          push(std::move(value));
+          break;
+        }
+        case OpCode::Continue: {
+          // Parts already run are freed, functions they declared keep their own chunks
+          frame->chunk = chunk->next;
+          chunk = frame->chunk.get();
+          code = chunk->code.data();
+          ip = 0;
+          break;
+        }
+      }
+    }
+  }
+
+private:
+  struct CallFrame {
+    std::shared_ptr<const Chunk> chunk;
+    size_t ip;
+    std::shared_ptr<Frame> caller_frame;
+    size_t stack_base;
+    Symbol function;
+    // Its arguments are kept just below stack_base
+    const FunctionDeclaration* memoized = nullptr;
+  };
+
+  // Callers are paused just after their call instruction, the current frame is at line
+  void sample(int line) {
+    std::vector<Profiler::Frame> stack;
+    stack.reserve(m_frames.size());
+    for (size_t idx = 0; idx + 1 < m_frames.size(); ++idx) {
+      stack.emplace_back(Profiler::Frame{ m_frames[idx].function, m_frames[idx].chunk->lines[m_frames[idx].ip - 1] });
+    }
+    stack.emplace_back(Profiler::Frame{ m_frames.back().function, line });
+
+    m_profiler->record(stack);
+  }
+
+  void push(RuntimeVal value) {
+    m_stack.emplace_back(std::move(value));
+  }
+
+  RuntimeVal pop() {
+    RuntimeVal value = std::move(m_stack.back());
+    m_stack.pop_back();
+    return value;
+  }
+
+  void binary(TokenType type, int line) {
+    RuntimeVal rhs = pop();
+    RuntimeVal lhs = pop();
+    push(m_operators.eval_binary(lhs, rhs, Token{ type, line }));
+  }
+
+  void boolean(TokenType type, int line) {
+    RuntimeVal rhs = pop();
+    RuntimeVal lhs = pop();
+    push(Operators::make_bool(m_operators.eval_boolean(lhs, rhs, Token{ type, line })));
+  }
+
+private:
+  Error& m_error;
+  Environment m_env;
+  Operators m_operators;
+  std::vector<RuntimeVal> m_stack;
+  std::vector<CallFrame> m_frames;
+  Profiler* m_profiler = nullptr;
+  size_t m_max_call_depth = Environment::default_max_call_depth;
+  MemoCache* m_memo = nullptr;
+};
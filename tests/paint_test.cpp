@@ -0,0 +1,359 @@
+// Runs every test program through the paint binary and compares its output, standard output and
+// error together, with the expected output. Each mode runs the programs a different way, so the
+// engines and input paths are all checked against the same expected output.
+//
+// Usage: paint_test <vm | tree-walk | stream | parse-jobs | image>
+//
+// Programs are the .wp files in tests/cases with a .out file of the same name, the examples in
+// the repository root listed in tests/examples, and a few large programs generated here. A first
+// line of `# paint: <flags>` passes extra flags to paint for that program.
+
+#include "../bench/generate.hpp"
+#include "../src/image.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef PAINT_BINARY
+#define PAINT_BINARY "paint"
+#endif
+
+#ifndef TEST_DIR
+#define TEST_DIR "tests"
+#endif
+
+#ifndef EXAMPLES_DIR
+#define EXAMPLES_DIR "."
+#endif
+
+struct Case {
+  std::string name;
+  std::filesystem::path path;
+  std::string expected;
+  std::vector<std::string> flags;
+};
+
+struct RunResult {
+  std::string output;
+  int status;
+};
+
+std::string read_file(const std::filesystem::path& path) {
+  std::ifstream file(path, std::ios::binary);
+  std::stringstream text;
+  text << file.rdbuf();
+  return text.str();
+}
+
+// Flags from a `# paint:` first line
+std::vector<std::string> read_flags(const std::filesystem::path& path) {
+  std::ifstream file(path);
+  std::string line;
+  std::getline(file, line);
+
+  std::vector<std::string> flags;
+  if (line.starts_with("# paint:")) {
+    std::istringstream words(line.substr(8));
+    for (std::string flag; words >> flag;) {
+      flags.emplace_back(flag);
+    }
+  }
+
+  return flags;
+}
+
+// Run paint with the arguments, reading standard input from stdin_path if it is given, and
+// collect everything it writes to standard output and error in order
+RunResult run(const std::vector<std::string>& args, const std::filesystem::path& stdin_path = {}) {
+  int out_pipe[2];
+  if (pipe(out_pipe) != 0) {
+    std::cerr << "Could not create pipe.\n";
+    std::exit(EXIT_FAILURE);
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(out_pipe[1], STDOUT_FILENO);
+    dup2(out_pipe[1], STDERR_FILENO);
+    close(out_pipe[0]);
+
+    if (!stdin_path.empty()) {
+      int in_fd = open(stdin_path.c_str(), O_RDONLY);
+      dup2(in_fd, STDIN_FILENO);
+    }
+
+    std::vector<const char*> argv = { PAINT_BINARY };
+    for (const std::string& arg : args) {
+      argv.emplace_back(arg.c_str());
+    }
+    argv.emplace_back(nullptr);
+
+    execv(PAINT_BINARY, const_cast<char* const*>(argv.data()));
+    _exit(127);
+  }
+
+  close(out_pipe[1]);
+  RunResult result{ "", 0 };
+  char buffer[4096];
+  ssize_t count;
+  while ((count = read(out_pipe[0], buffer, sizeof(buffer))) > 0) {
+    result.output.append(buffer, count);
+  }
+  close(out_pipe[0]);
+
+  waitpid(pid, &result.status, 0);
+  return result;
+}
+
+// A program with more variables in one scope than slots can address
+Case too_many_slots(const std::filesystem::path& dir) {
+  std::filesystem::path path = dir / "too_many_slots.wp";
+  std::ofstream out(path);
+  for (int idx = 0; idx < 70000; ++idx) {
+    out << "let v" << idx << " = " << idx << "\n";
+  }
+  out << "print(v69999)\n";
+
+  return Case{ "too_many_slots", path,
+    "Error on line: 65536\n65536 | let v65535 = 65535\n\n"
+    "Too many variables in scope, at most 65536 can be declared in one function at once.\n", {} };
+}
+
+// A program with more literals and names than one chunk's 16 bit operands can address
+Case many_constants(const std::filesystem::path& dir) {
+  std::filesystem::path path = dir / "many_constants.wp";
+  std::ofstream out(path);
+  std::string expected;
+  for (int idx = 0; idx < 70000; ++idx) {
+    out << "print(" << idx << ".5)\n";
+    expected += std::to_string(idx) + ".5\n";
+  }
+
+  return Case{ "many_constants", path, expected, {} };
+}
+
+// A program large enough to be cut into several chunks by --parse-jobs
+Case large_program(const std::filesystem::path& large) {
+  return Case{ "large_program", large, "129.600000\n", {} };
+}
+
+// Copy the large program with each line inserted before the first function at or after its
+// percentage of the way through, so they land in different --parse-jobs chunks. Lines are
+// inserted from the end backwards, and the number of the last one inserted is returned.
+std::pair<std::filesystem::path, size_t> insert_lines(const std::filesystem::path& dir, const std::filesystem::path& large,
+    const std::string& name, const std::vector<std::pair<size_t, std::string>>& inserts) {
+  std::vector<std::string> lines;
+  std::ifstream in(large);
+  for (std::string line; std::getline(in, line);) {
+    lines.emplace_back(line);
+  }
+
+  size_t last_line = 0;
+  for (const auto& [percent, inserted] : inserts) {
+    size_t at = lines.size() * percent / 100;
+    while (at < lines.size() && !lines[at].starts_with("fn ")) {
+      ++at;
+    }
+
+    if (at == lines.size()) {
+      std::cerr << "No function to put an error before in " << large << "\n";
+      std::filesystem::remove_all(dir);
+      std::exit(EXIT_FAILURE);
+    }
+
+    lines.insert(lines.begin() + at, inserted);
+    last_line = at + 1;
+  }
+
+  std::filesystem::path path = dir / (name + ".wp");
+  std::ofstream out(path);
+  for (const std::string& line : lines) {
+    out << line << "\n";
+  }
+
+  return { path, last_line };
+}
+
+// The large program with a syntax error in two of its chunks, the earlier one is reported
+Case large_program_errors(const std::filesystem::path& dir, const std::filesystem::path& large) {
+  auto [path, first_error] = insert_lines(dir, large, "large_program_errors", { { 80, "let = 5" }, { 30, "let = 5" } });
+
+  std::string line = std::to_string(first_error);
+  return Case{ "large_program_errors", path,
+    "Error on line: " + line + "\n" + line + " | let = 5\n\n"
+    "Unexpected token: `=` \nExpected identifier following variable declaration keyword.\n", {} };
+}
+
+// The large program with a string left open in a late chunk and an invalid character in an
+// earlier one. Tokenizer errors are found on the chunks' threads, the earlier one is reported.
+Case large_program_token_errors(const std::filesystem::path& dir, const std::filesystem::path& large) {
+  auto [path, first_error] = insert_lines(dir, large, "large_program_token_errors",
+      { { 80, "let open = \"never closed" }, { 30, "let at = 5 @" } });
+
+  std::string line = std::to_string(first_error);
+  return Case{ "large_program_token_errors", path,
+    "Error on line: " + line + "\n" + line + " | let at = 5 @\n\nInvalid character: `@`.\n", {} };
+}
+
+std::vector<Case> collect_cases(const std::filesystem::path& dir) {
+  std::vector<Case> cases;
+  for (const auto& entry : std::filesystem::directory_iterator(std::filesystem::path(TEST_DIR) / "cases")) {
+    std::filesystem::path path = entry.path();
+    if (path.extension() == ".wp") {
+      std::filesystem::path expected = path;
+      cases.emplace_back(Case{ path.stem(), path, read_file(expected.replace_extension(".out")), read_flags(path) });
+    }
+  }
+
+  for (const auto& entry : std::filesystem::directory_iterator(std::filesystem::path(TEST_DIR) / "examples")) {
+    std::filesystem::path path = std::filesystem::path(EXAMPLES_DIR) / entry.path().stem();
+    cases.emplace_back(Case{ path.stem(), path.replace_extension(".wp"), read_file(entry.path()), {} });
+  }
+
+  cases.emplace_back(too_many_slots(dir));
+  cases.emplace_back(many_constants(dir));
+
+  // Generated once for this run and shared by the cases built from it
+  std::filesystem::path large = generate_large_file("large_program.wp", 4000, dir);
+  cases.emplace_back(large_program(large));
+  cases.emplace_back(large_program_errors(dir, large));
+  cases.emplace_back(large_program_token_errors(dir, large));
+
+  std::sort(cases.begin(), cases.end(), [](const Case& lhs, const Case& rhs) { return lhs.name < rhs.name; });
+  return cases;
+}
+
+// Run the case the way the mode asks, returning a description of every mismatch
+std::vector<std::string> check(const Case& test, const std::string& mode, const std::filesystem::path& dir) {
+  std::vector<std::pair<std::string, RunResult>> runs;
+  auto args = [&](std::initializer_list<std::string> extra, const std::filesystem::path& path) {
+    std::vector<std::string> all = test.flags;
+    all.insert(all.end(), extra);
+    all.emplace_back(path);
+    return all;
+  };
+
+  if (mode == "vm") {
+    runs.emplace_back("", run(args({}, test.path)));
+  } else if (mode == "tree-walk") {
+    runs.emplace_back("", run(args({ "--tree-walk" }, test.path)));
+  } else if (mode == "stream") {
+    runs.emplace_back("", run(args({}, "-"), test.path));
+  } else if (mode == "parse-jobs") {
+    runs.emplace_back("", run(args({ "--parse-jobs", "4" }, test.path)));
+  } else if (mode == "image") {
+    // Compile a copy so the image is written outside the source tree, then run it on both engines
+    std::filesystem::create_directories(dir / "images");
+    std::filesystem::path copy = dir / "images" / (test.name + ".wp");
+    std::filesystem::copy_file(test.path, copy, std::filesystem::copy_options::overwrite_existing);
+    std::filesystem::remove(copy.string() + "c");
+    RunResult compiled = run(args({ "--compile" }, copy));
+    if (compiled.status == 0 && !std::filesystem::exists(copy.string() + "c")) {
+      return { "--compile succeeded without writing an image" };
+    }
+    runs.emplace_back(" from its image", run(args({}, copy)));
+    runs.emplace_back(" from its image with --tree-walk", run(args({ "--tree-walk" }, copy)));
+  } else {
+    std::cerr << "Unknown mode: " << mode << "\n";
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::vector<std::string> failures;
+  for (const auto& [how, result] : runs) {
+    if (WIFSIGNALED(result.status)) {
+      failures.emplace_back("crashed" + how + " with signal " + std::to_string(WTERMSIG(result.status)));
+    } else if (result.output != test.expected) {
+      failures.emplace_back("output" + how + " differs, expected:\n" + test.expected + "got:\n" + result.output);
+    }
+  }
+
+  return failures;
+}
+
+// Damage each byte of a small program's image in turn, fixing up the body hash so only the
+// reader's own checks stand between the damage and the engines. No run may crash, a damaged
+// image is either rejected and the source parsed instead, or still a program that runs.
+std::vector<std::string> check_damaged_images(const std::filesystem::path& dir) {
+  std::filesystem::path path = dir / "damaged_image.wp";
+  std::ofstream(path) << "fn add(a, b) {\n  return a + b\n}\n\n"
+                         "let point = { x = 1, y = add(2, 3) }\nlet total = point.y\ntotal++\nprint(total)\n";
+
+  std::filesystem::path image_path = Image::path_for(path);
+  run({ "--compile", path });
+  std::string image = read_file(image_path);
+
+  // The body hash follows the magic bytes, version, source size and source hash
+  size_t hash_at = sizeof(Image::magic) + sizeof(Image::version) + 2 * sizeof(uint64_t);
+  size_t body_at = hash_at + sizeof(uint64_t);
+  if (image.size() <= body_at) {
+    return { "--compile did not write an image" };
+  }
+
+  std::vector<std::string> failures;
+  for (size_t pos = body_at; pos < image.size(); ++pos) {
+    for (uint8_t change : { 0x01, 0xFF }) {
+      std::string damaged = image;
+      damaged[pos] ^= change;
+      uint64_t body_hash = Image::hash(std::string_view(damaged).substr(body_at));
+      std::memcpy(damaged.data() + hash_at, &body_hash, sizeof(body_hash));
+      std::ofstream(image_path, std::ios::binary | std::ios::trunc).write(damaged.data(), damaged.size());
+
+      std::vector<std::pair<std::string, RunResult>> runs;
+      runs.emplace_back("", run({ path }));
+      runs.emplace_back(" with --tree-walk", run({ "--tree-walk", path }));
+      for (const auto& [how, result] : runs) {
+        if (WIFSIGNALED(result.status)) {
+          failures.emplace_back("crashed" + how + " with signal " + std::to_string(WTERMSIG(result.status)) +
+              " after byte " + std::to_string(pos) + " was changed by " + std::to_string(change));
+        }
+      }
+    }
+  }
+
+  return failures;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    std::cerr << "Usage: paint_test <vm | tree-walk | stream | parse-jobs | image>\n";
+    return EXIT_FAILURE;
+  }
+
+  std::string mode = argv[1];
+  std::filesystem::path dir = std::filesystem::temp_directory_path() / ("paint_test_" + mode + "_" + std::to_string(getpid()));
+  std::filesystem::create_directories(dir);
+
+  size_t checked = 0;
+  size_t failed = 0;
+  auto report = [&](const std::string& name, const std::vector<std::string>& failures) {
+    std::cout << (failures.empty() ? "pass " : "FAIL ") << name << "\n";
+    for (const std::string& failure : failures) {
+      std::cout << "  " << failure << "\n";
+    }
+
+    ++checked;
+    failed += !failures.empty();
+  };
+
+  for (const Case& test : collect_cases(dir)) {
+    report(test.name, check(test, mode, dir));
+  }
+
+  if (mode == "image") {
+    report("damaged_images", check_damaged_images(dir));
+  }
+
+  std::filesystem::remove_all(dir);
+  std::cout << checked - failed << " of " << checked << " passed (" << mode << ")\n";
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}